@@ -46,7 +46,9 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <signal.h>
 #include "json_data_processor.h"
+#include "json_feed_schemas.h"
 
 using namespace std;
 
@@ -163,10 +165,15 @@ void test_raw_data_reader(const string& infile)
     }
 }
 
-void test_data_processor(const string& infile, const string& outfile)
+int test_data_processor(json_data_processor& dp, const string& infile, const string& outfile, const raw_reader_options& read_opts)
 {
-    json_data_processor dp;
-    dp.process(infile, outfile);
+    return dp.process(infile, outfile, read_opts);
+}
+
+int test_data_processor(json_data_processor& dp, const vector<string>& infiles, const string& outname, const raw_reader_options& read_opts,
+                        bool split_output, int jobs)
+{
+    return dp.process(infiles, outname, read_opts, split_output, jobs);
 }
 
 void test_tlv_value()
@@ -184,17 +191,166 @@ void test_tlv_value()
     tstr = tstr;
 }
 
+/**
+  Parse a byte range given as "START:END", either end may be omitted.
+  Returns -1 if the range is malformed.
+*/
+int parse_range(const string& spec, raw_reader_options& opts)
+{
+    size_t sep = spec.find(':');
+    if (string::npos == sep)
+        return -1;
+
+    string sbeg = spec.substr(0, sep), send = spec.substr(sep + 1);
+    char* pend = nullptr;
+    opts.range_begin = sbeg.empty() ? 0 : strtoull(sbeg.c_str(), &pend, 10);
+    if (pend && *pend)
+        return -1;
+    pend = nullptr;
+    opts.range_end = send.empty() ? UINT64_MAX : strtoull(send.c_str(), &pend, 10);
+    if (pend && *pend)
+        return -1;
+
+    return opts.range_begin <= opts.range_end ? 0 : -1;
+}
+
+#if defined(__linux__)
+void on_stop_signal(int)
+{
+    raw_follow_source::request_stop();
+}
+#endif
+
 void usage(int argc, const char* argv[])
 {
-    printf("Usage: %s <input file> <output file>\n", argv[0]);
+    printf("Usage: %s [options] <input file>... <output file>\n", argv[0]);
+    printf("The input file may be '-' for the standard input, a pipe or a FIFO.\n");
+    printf("Several input files (or a manifest) are read concurrently and share a single key dictionary.\n");
+    printf("Options:\n");
+    printf("  --mmap              memory-map the input file and parse the lines in place\n");
+    printf("  --read-ahead[=N]    read the input on a background thread, N buffers ahead (default %d)\n", 
+            raw_read_ahead_source::DEFAULT_BUFFER_COUNT);
+    printf("  --uring             read the input with io_uring, keeping N (--read-ahead) reads in flight\n");
+    printf("  --direct            read the input with O_DIRECT, bypassing the page cache (one-shot bulk conversions)\n");
+    printf("  --range START:END   process only the lines starting in the byte range [START, END) of the input\n");
+    printf("  --follow            keep reading the input file as it grows, until it is deleted, renamed or on SIGINT/SIGTERM\n");
+    printf("  --checkpoint[=MB]   write a checkpoint to '<output file>.ckpt' every MB megabytes of input (default %llu)\n",
+            (unsigned long long)(json_data_processor::DEFAULT_CHECKPOINT_INTERVAL >> 20));
+    printf("  --resume            continue an interrupted run from its last checkpoint\n");
+    printf("  --input-order       keep the keys of each record in their input order instead of sorting them\n");
+    printf("  --quarantine FILE   write the rejected records to FILE, with their input offsets and the reasons\n");
+    printf("  --schema NAME       parse the records of the feed NAME (order, trade, quote) with its declared\n");
+    printf("                      record type, the other lines go through the generic parsers\n");
+    printf("  --dict-in FILE      preload the key dictionary from FILE (written by --dict-out or --dict-image), its keys\n");
+    printf("                      keep their IDs\n");
+    printf("  --dict-out FILE     also write the key dictionary of the run to FILE\n");
+    printf("  --dict-image FILE   also write the key dictionary of the run to FILE as an image to be mmapped\n");
+    printf("  --manifest FILE     read the list of the input files from FILE, one per line\n");
+    printf("  --jobs=N            number of the concurrent input file readers (default %d)\n", raw_multi_file_reader::DEFAULT_JOBS);
+    printf("  --split-output      write one output stream per input file into the output directory, plus\n");
+    printf("                      the shared dictionary in '%s'\n", json_data_processor::DICTIONARY_FILE_NAME);
     exit(-1);
 }
 
 int main(int argc, const char* argv[])
 {
-    if (argc < 3)
+    raw_reader_options read_opts;
+    vector<string> files;
+    string manifest;
+    bool split_output = false;
+    int jobs = raw_multi_file_reader::DEFAULT_JOBS;
+    uint64_t checkpoint_interval = 0;
+    bool resume = false;
+    bool input_key_order = false;
+    string quarantine;
+    vector<string> schemas;
+    string dict_in, dict_out, dict_image;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--mmap")
+            read_opts.mode = raw_read_mode::mmap;
+        else if (arg == "--uring")
+            read_opts.mode = raw_read_mode::uring;
+        else if (arg == "--direct")
+            read_opts.mode = raw_read_mode::direct;
+        else if (arg == "--read-ahead")
+            read_opts.read_ahead_buffers = raw_read_ahead_source::DEFAULT_BUFFER_COUNT;
+        else if (arg.compare(0, 13, "--read-ahead=") == 0)
+            read_opts.read_ahead_buffers = atoi(arg.c_str() + 13);
+        else if (arg == "--follow")
+            read_opts.follow = true;
+        else if (arg == "--checkpoint")
+            checkpoint_interval = json_data_processor::DEFAULT_CHECKPOINT_INTERVAL;
+        else if (arg.compare(0, 13, "--checkpoint=") == 0)
+            checkpoint_interval = strtoull(arg.c_str() + 13, nullptr, 10) << 20;
+        else if (arg == "--resume")
+            resume = true;
+        else if (arg == "--input-order")
+            input_key_order = true;
+        else if (arg == "--quarantine" && i + 1 < argc)
+            quarantine = argv[++i];
+        else if (arg == "--schema" && i + 1 < argc)
+            schemas.push_back(argv[++i]);
+        else if (arg == "--dict-in" && i + 1 < argc)
+            dict_in = argv[++i];
+        else if (arg == "--dict-out" && i + 1 < argc)
+            dict_out = argv[++i];
+        else if (arg == "--dict-image" && i + 1 < argc)
+            dict_image = argv[++i];
+        else if (arg == "--manifest" && i + 1 < argc)
+            manifest = argv[++i];
+        else if (arg == "--split-output")
+            split_output = true;
+        else if (arg.compare(0, 7, "--jobs=") == 0)
+            jobs = atoi(arg.c_str() + 7);
+        else if (arg == "--range" && i + 1 < argc)
+        {
+            if (-1 == parse_range(argv[++i], read_opts))
+                usage(argc, argv);
+        }
+        else if (arg.compare(0, 8, "--range=") == 0)
+        {
+            if (-1 == parse_range(arg.substr(8), read_opts))
+                usage(argc, argv);
+        }
+        else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+            usage(argc, argv);
+        else
+            files.push_back(arg);
+    }
+
+    if (files.size() < 1)
+        usage(argc, argv);
+
+    string outfile = files.back();
+    files.pop_back();
+
+    if (!manifest.empty() && -1 == read_manifest(manifest, files))
+    {
+        printf("Failed to read the manifest file: '%s'\n", manifest.c_str());
+        return -1;
+    }
+
+    if (files.empty())
+        usage(argc, argv);
+
+    // Following, byte ranges and checkpoints apply to a single input only
+    bool multi_input = files.size() > 1 || !manifest.empty() || split_output;
+    bool has_range = read_opts.range_begin != 0 || read_opts.range_end != UINT64_MAX;
+    if (multi_input && (read_opts.follow || has_range || checkpoint_interval || resume))
         usage(argc, argv);
 
+#if defined(__linux__)
+    // Let a followed input end gracefully, so that the key dictionary still gets written
+    if (read_opts.follow)
+    {
+        signal(SIGINT, on_stop_signal);
+        signal(SIGTERM, on_stop_signal);
+    }
+#endif
+
     try
     {
         //tlv_test_not_init();
@@ -202,8 +358,35 @@ int main(int argc, const char* argv[])
         //tlv_test_write_read_string();
         //test_raw_data_reader(argv[1]);
         //test_tlv_value();
-        test_data_processor(argv[1], argv[2]);
-        return 0;
+        json_data_processor dp;
+        dp.set_checkpointing(checkpoint_interval, resume);
+        dp.set_input_key_order(input_key_order);
+        if (!quarantine.empty() && -1 == dp.set_quarantine(quarantine, resume))
+        {
+            printf("Failed to open the quarantine file: '%s'\n", quarantine.c_str());
+            return -1;
+        }
+        if (!dict_in.empty() && -1 == dp.load_dictionary(dict_in))
+        {
+            printf("Failed to read the dictionary file: '%s'\n", dict_in.c_str());
+            return -1;
+        }
+        if (!dict_out.empty())
+            dp.set_dictionary_output(dict_out);
+        if (!dict_image.empty())
+            dp.set_dictionary_image_output(dict_image);
+        for (const string& schema : schemas)
+        {
+            if (-1 == add_feed_schema(dp, schema))
+            {
+                printf("Unknown record schema: '%s'\n", schema.c_str());
+                return -1;
+            }
+        }
+
+        if (multi_input)
+            return test_data_processor(dp, files, outfile, read_opts, split_output, jobs);
+        return test_data_processor(dp, files[0], outfile, read_opts);
     }
     catch (const runtime_error& e)
     {
@@ -0,0 +1,103 @@
+#ifndef JSON_CHECKPOINT_HEADER
+#define JSON_CHECKPOINT_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "json_tlv_serializer.h"
+#include "json_tlv_value.h"
+#include "json_common.h"
+
+/**
+  * The state of an ingestion at a record boundary: everything before 'input_offset' has been
+  * encoded into the first 'output_offset' bytes of the output, using the given key dictionary, and its
+  * rejected records fill the first 'quarantine_offset' bytes of the quarantine file.
+*/
+struct checkpoint_state
+{
+    uint64_t                            input_offset{0};
+    uint64_t                            output_offset{0};
+    uint64_t                            quarantine_offset{0};
+    dictionary_value_type               next_key{0};
+    key_dictionary                      keys;
+};
+
+/**
+  * Sidecar file "<output>.ckpt" holding the last checkpoint of an output, in the same TLV encoding
+  * as the output itself: the input offset (uint64), the output offset (uint64), the quarantine
+  * file offset (uint64), the last assigned key ID (int16) and then the dictionary exactly as 'dump_map' writes it.
+  * A checkpoint is written to a temporary file that is synced and then renamed over the previous
+  * one, so there is always a complete checkpoint on disk.
+*/
+class checkpoint_file
+{
+public:
+    using string = std::string;
+
+    explicit checkpoint_file(const string& output_file_name)
+        : name_(output_file_name + ".ckpt")
+    {}
+
+    int save(const checkpoint_state& st)
+    {
+        string tmp_name = name_ + ".tmp";
+        {
+            tlv_data_serializer ds;
+            if (-1 == ds.init(tmp_name))
+                return -1;
+
+            vector<tlv_value> header;
+            header.push_back(tlv_value(st.input_offset));
+            header.push_back(tlv_value(st.output_offset));
+            header.push_back(tlv_value(st.quarantine_offset));
+            header.push_back(tlv_value(st.next_key));
+            ds.dump_to_file(header);
+            ds.dump_map(st.keys);
+            ds.sync();
+        }
+
+#if defined(_WIN32)
+        ::remove(name_.c_str());
+#endif
+        return 0 == ::rename(tmp_name.c_str(), name_.c_str()) ? 0 : -1;
+    }
+
+    // Returns -1 if there is no checkpoint or it cannot be read
+    int load(checkpoint_state& st)
+    {
+        tlv_data_serializer ds;
+        if (-1 == ds.open_existing(name_))
+            return -1;
+
+        tlv_value tin, tout, tquar, tkey;
+        if (0 != ds.read_tlv_object(tin) || tin.type() != tlv_type::TLVT_UINT64
+            || 0 != ds.read_tlv_object(tout) || tout.type() != tlv_type::TLVT_UINT64
+            || 0 != ds.read_tlv_object(tquar) || tquar.type() != tlv_type::TLVT_UINT64
+            || 0 != ds.read_tlv_object(tkey) || tkey.type() != tlv_type::TLVT_INT16)
+            return -1;
+
+        st.input_offset = tin.get_value_as<uint64_t>();
+        st.output_offset = tout.get_value_as<uint64_t>();
+        st.quarantine_offset = tquar.get_value_as<uint64_t>();
+        st.next_key = tkey.get_value_as<dictionary_value_type>();
+        st.keys.clear();
+        return ds.load_map(st.keys);
+    }
+
+    // The output is complete, the checkpoint is of no use anymore
+    void remove()
+    {
+        ::remove(name_.c_str());
+    }
+
+    const string& name() const
+    {
+        return name_;
+    }
+
+private:
+    string name_;
+};
+
+#endif // JSON_CHECKPOINT_HEADER
@@ -17,7 +17,8 @@ enum class tlv_type : char
 	TLVT_UINT16 = 8,
 	TLVT_UINT32 = 9,
 	TLVT_UINT64 = 10,
-	TLVT_DOUBLE = 11
+	TLVT_DOUBLE = 11,
+	TLVT_FLOAT = 12
 };
 
 #endif // JSON_COMMON_HEADER
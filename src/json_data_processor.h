@@ -5,13 +5,29 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <set>
+#include <chrono>
 #include "json.hpp"
+#include "json_flat_parser.h"
+#include "json_shape_cache.h"
 #include "json_raw_data_reader.h"
+#include "json_multi_file_reader.h"
+#include "json_checkpoint.h"
+#include "json_quarantine.h"
+#include "json_utf8.h"
+#include "json_record_schema.h"
+#include "json_dictionary_image.h"
 #include "json_tlv_serializer.h"
 #include "json_tlv_value.h"
 #include "json_common.h"
 
 #include <stdint.h>
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 using std::vector;
 using std::map;
@@ -20,6 +36,8 @@ using std::map;
   * This class is the core processing logic of the application.
   * It reads the input file stream line-by-line using the data reader logic and dispatches the 
   * further pocessing of the data to the Nlohman's header-only json library (json.hpp). 
+  * The flat records (a single object of scalar values per line) take a faster path first, through
+  * the allocation free flat_record_parser, the DOM parser being the fallback for all the others.
   * Once the JSON procesing is done, this logic transforms and makes any required modifications
   * to the data, thus preparing for storing.
   * In the final stage of the proecessing this class uses the tlv_serializer to store the processed data
@@ -30,166 +48,787 @@ class json_data_processor
 public:
     
     using string = std::string;
+    using string_view = std::string_view;
     using json = nlohmann::json;
     
+    // Longest time the output of a followed file may stay unflushed while lines keep coming,
+    // checked every FOLLOW_FLUSH_CHECK_LINES lines
+    static constexpr int FOLLOW_FLUSH_INTERVAL_MS = 1000;
+    static constexpr int FOLLOW_FLUSH_CHECK_LINES = 1024;
+
+    // Name of the shared dictionary file when writing one output stream per input
+    static constexpr const char* DICTIONARY_FILE_NAME = "dictionary.tlv";
+
+    // Default amount of input between two checkpoints
+    static constexpr uint64_t DEFAULT_CHECKPOINT_INTERVAL = 256ull << 20;
+
     json_data_processor() = default;
     ~json_data_processor() { }
 
-    int process(const string& input_file_name, const string& output_file_name)
+    /**
+      Write a checkpoint every 'interval_bytes' of input (0 disables them) into "<output>.ckpt".
+      With 'resume' an interrupted run is continued: the output is cut back to the last checkpoint
+      and the processing picks up at its input offset, with its key dictionary.
+      Applies to the single input processing.
+    */
+    void set_checkpointing(uint64_t interval_bytes, bool resume)
+    {
+        checkpoint_interval_ = interval_bytes;
+        resume_ = resume;
+    }
+
+    /**
+      Keep the keys of each record in their input order. By default they are sorted, as the DOM
+      object orders them; with the input order the records rejected by the flat parser go through
+      the SAX interface instead of the DOM, and repeated keys are all kept.
+    */
+    void set_input_key_order(bool input_order)
     {
+        input_key_order_ = input_order;
+    }
+
+    /**
+      Write the rejected records to 'fname', with their input offsets and the reasons (see
+      record_quarantine). The rejected records are counted by their reason in any case, a bad record
+      never stops the run. With 'append' the file is continued, e.g. when resuming a run, from the
+      offset recorded in the checkpoint.
+      Returns -1 if the file cannot be opened.
+    */
+    int set_quarantine(const string& fname, bool append = false)
+    {
+        return quarantine_.open(fname, append);
+    }
+
+    /**
+      Preload the key dictionary from 'fname', either a dictionary image (see dictionary_image) or
+      a dictionary alone as 'dump_map' writes it: the DICTIONARY_FILE_NAME of a split output or the
+      dictionary output of an earlier run (see 'set_dictionary_output'). The keys found there keep
+      their IDs and the new ones are numbered after them, so that the outputs of the runs sharing a
+      dictionary lineage share their key IDs. An image is kept mapped and looked up in place.
+      Returns -1 if the file cannot be read, does not hold a dictionary or is cut short, or if two of
+      its keys share an ID.
+    */
+    int load_dictionary(const string& fname)
+    {
+        // An image is used in place, only the keys added by the run go into map_keys_
+        if (dictionary_image::is_image_file(fname))
+        {
+            if (-1 == base_keys_.open(fname))
+                return -1;
+            map_keys_.clear();
+            next_key_ = base_keys_.last_id();
+            return 0;
+        }
+
+        key_dictionary keys;
+        tlv_data_serializer ds;
+        if (-1 == ds.open_existing(fname) || -1 == ds.load_map(keys))
+            return -1;
+
+        // Two keys sharing an ID could not be told apart when decoding
+        dictionary_value_type last_key = 0;
+        std::set<dictionary_value_type> ids;
+        for (auto& [key, id] : keys.sorted_entries())
+        {
+            if (!ids.insert(id).second)
+                return -1;
+            last_key = std::max(last_key, id);
+        }
+
+        base_keys_.close();
+        map_keys_ = std::move(keys);
+        next_key_ = last_key;
+        return 0;
+    }
+
+    // Also write the key dictionary of the run to 'fname' at the end, in the 'load_dictionary' format
+    void set_dictionary_output(const string& fname)
+    {
+        dict_out_name_ = fname;
+    }
+
+    // Also write the key dictionary of the run to 'fname' at the end, as a dictionary image
+    void set_dictionary_image_output(const string& fname)
+    {
+        dict_image_name_ = fname;
+    }
+
+    /**
+      Add a record type declared with TLV_RECORD: the lines matching it exactly are parsed and encoded
+      by its generated code, ahead of the flat parser. The types are tried in the order they are added.
+    */
+    template <typename Record>
+    void add_record_schema()
+    {
+        schemas_.push_back(std::make_unique<record_schema<Record>>());
+    }
+
+    int process(const string& input_file_name, const string& output_file_name, 
+                const raw_reader_options& read_opts = raw_reader_options())
+    {
+        auto time_start = std::chrono::steady_clock::now();
+        tlv_data_serializer ds;
+
+        // When following a growing file, flush the output each time the input runs dry
+        raw_reader_options opts = read_opts;
+        if (opts.follow)
+            opts.on_idle = [this, &ds]() { ds.flush(); quarantine_.flush(); };
+
+        // A checkpoint refers to an input offset, which piped and compressed input cannot be reopened at
+        bool resumable = raw_data_file_reader::supports_offsets(input_file_name);
+        if (resume_ && !resumable)
+        {
+            printf("Cannot resume from a checkpoint, the input is piped or compressed: '%s'\n", input_file_name.c_str());
+            return -1;
+        }
+        if (checkpoint_interval_ > 0 && !resumable)
+            printf("Not writing checkpoints, the input is piped or compressed: '%s'\n", input_file_name.c_str());
+
+        // Pick up an interrupted run where its last checkpoint left off
+        checkpoint_file ckpt(output_file_name);
+        checkpoint_state resume_st;
+        bool resuming = resume_ && 0 == ckpt.load(resume_st);
+        if (resuming)
+        {
+            printf("Resuming from '%s' at input offset %llu, output offset %llu\n", ckpt.name().c_str(),
+                    (unsigned long long)resume_st.input_offset, (unsigned long long)resume_st.output_offset);
+            map_keys_ = resume_st.keys;
+            next_key_ = resume_st.next_key;
+            if (resume_st.input_offset > opts.range_begin)
+                opts.range_begin = resume_st.input_offset;
+        }
+
+        // The records rejected after the checkpoint (all of them without one) are met again
+        if (resume_ && -1 == quarantine_.truncate_at(resuming ? resume_st.quarantine_offset : 0))
+        {
+            printf("Failed to cut back the quarantine file: '%s'\n", quarantine_.name().c_str());
+            return -1;
+        }
+
         raw_data_file_reader rdr;
-        if (-1 == rdr.open(input_file_name))
+        if (-1 == rdr.open(input_file_name, opts))
         {
             printf("Failed to open the input file: '%s'\n", input_file_name.c_str());
             return -1;
         }
 
-        tlv_data_serializer ds;
-        if (-1 == ds.init(output_file_name))
+        if (-1 == (resuming ? ds.reopen_at(output_file_name, resume_st.output_offset) : ds.init(output_file_name)))
         {
             printf("Failed to open the output file: '%s'\n", output_file_name.c_str());
             return -1;
         }
 
-        string line;
+        bool checkpointing = resumable && (checkpoint_interval_ > 0 || resume_);
+        uint64_t checkpoint_interval = checkpoint_interval_ > 0 ? checkpoint_interval_ : DEFAULT_CHECKPOINT_INTERVAL;
+        uint64_t last_checkpoint = opts.range_begin;
+
+        string_view line;
         int rv;
+        uint64_t line_count = 0;
+        auto last_flush = std::chrono::steady_clock::now();
+
         while ((rv = rdr.read(line)) != -1)
         {
+            // ... and also at bounded intervals while it keeps flowing
+            if (opts.follow && 0 == (++line_count % FOLLOW_FLUSH_CHECK_LINES))
+            {
+                auto now = std::chrono::steady_clock::now();
+                if (now - last_flush >= std::chrono::milliseconds(FOLLOW_FLUSH_INTERVAL_MS))
+                {
+                    ds.flush();
+                    quarantine_.flush();
+                    last_flush = now;
+                }
+            }
+
             if (0 == rv)
                 continue;
 
-            json jst;
-            //nlohmann::ordered_json jst;
-
-            printf("----------------------------------------------------------------------------------------------------\n");
+            record_error err = process_line(line, ds);
+            if (record_error::none != err)
+                reject(input_file_name, rdr.line_offset(), err, line);
 
-            if (-1 == parse_json_line(line, jst))
+            if (checkpointing && rdr.next_offset() - last_checkpoint >= checkpoint_interval)
             {
-                printf("Failed to process line '%s'\n", line.c_str());
-                continue;
+                last_checkpoint = rdr.next_offset();
+                save_checkpoint(ckpt, ds, last_checkpoint);
             }
-            
-            vector<tlv_value> tlv_vals;
+        }
+        
+        // Write the key mapping to the out put file
+        ds.dump_map(all_keys());
+        quarantine_.flush();
+
+        // The output is complete
+        if (checkpointing)
+        {
+            ds.sync();
+            ckpt.remove();
+        }
+
+        if (-1 == save_dictionary())
+            return -1;
+
+        print_stats(rdr.backend_name(), rdr.stats(), std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count());
+        return 0;
+    }
+
+    /**
+      Process several input files with a single key dictionary, the files are read concurrently by
+      a pool of 'jobs' reader threads.
+      Without 'split_output' all the records go to one combined output stream, followed by the
+      dictionary. With it, the output name is a directory that receives one stream per input file,
+      named after the input, and the shared dictionary in DICTIONARY_FILE_NAME.
+    */
+    int process(const vector<string>& input_file_names, const string& output_name,
+                const raw_reader_options& read_opts, bool split_output, int jobs = raw_multi_file_reader::DEFAULT_JOBS)
+    {
+        auto time_start = std::chrono::steady_clock::now();
+
+        raw_multi_file_reader rdr;
+        if (-1 == rdr.open(input_file_names, read_opts, jobs))
+        {
+            printf("No input files to process\n");
+            return -1;
+        }
+
+        tlv_data_serializer ds;
+        vector<string> out_names;
+        if (split_output)
+        {
+            make_directory(output_name);
+            out_names = per_input_output_names(input_file_names, output_name);
+        }
+        else if (-1 == ds.init(output_name))
+        {
+            printf("Failed to open the output file: '%s'\n", output_name.c_str());
+            return -1;
+        }
 
-            for (auto it = jst.begin(); it != jst.end(); ++it)
+        string_view line;
+        int rv, file_index, out_index = -1;
+        while ((rv = rdr.read(line, file_index)) != -1)
+        {
+            // Moving on to the next input, also create the outputs of the empty ones skipped over
+            while (split_output && out_index < file_index)
             {
-                string stype, skey;
-                tlv_value tlv;
-                process_value(it, tlv, stype, skey);
-                
-                int32_t mapped_key = get_mapped_key(skey);
-                tlv_value val_key(mapped_key);
-
-                tlv_vals.push_back(val_key);
-                tlv_vals.push_back(tlv);
-
-                printf("%-60s key: %-12s mapped key: %d\n", 
-                        tlv.as_string_rep().c_str()
-                        , skey.c_str()
-                        , mapped_key
-                        );
-#if 0
-                if (tlv.type() == tlv_type::TLVT_STRING)
+                if (-1 == ds.init(out_names[++out_index]))
                 {
-                    string s = tlv.get_value_as<string>();
-                    printf("type: %-5d %-12s key: %-8s value: %-20s mapped_key: %d\n", 
-                                    tlv.type(), 
-                                    stype.c_str(), 
-                                    skey.c_str(),
-                                    s.c_str(),
-                                    mapped_key
-                                    );
-                }
-                else
-                {
-                    uint64_t val = tlv.get_value_as<uint8_t>();
-                    printf("type: %-5d %-12s key: %-8s value: %-20llu mapped_key: %d\n", 
-                                    tlv.type(), 
-                                    stype.c_str(), 
-                                    skey.c_str(),
-                                    val,
-                                    mapped_key
-                                    );
-
+                    printf("Failed to open the output file: '%s'\n", out_names[out_index].c_str());
+                    return -1;
                 }
-#endif           //continue;
             }
 
-            ds.dump_to_file(tlv_vals);
+            if (0 == rv)
+                continue;
+
+            record_error err = process_line(line, ds);
+            if (record_error::none != err)
+                reject(input_file_names[file_index], rdr.line_offset(), err, line);
         }
-        
-        // Write the key mapping to the out put file
-        ds.dump_map(map_keys_);
 
+        while (split_output && out_index + 1 < (int)out_names.size())
+            ds.init(out_names[++out_index]);
+
+        // Write the key mapping, either after the combined records or to its own file
+        if (split_output)
+        {
+            string dict_name = output_name + "/" + DICTIONARY_FILE_NAME;
+            if (-1 == ds.init(dict_name))
+            {
+                printf("Failed to open the output file: '%s'\n", dict_name.c_str());
+                return -1;
+            }
+        }
+        ds.dump_map(all_keys());
+        quarantine_.flush();
+
+        if (-1 == save_dictionary())
+            return -1;
+
+        print_stats(rdr.backend_name(), rdr.stats(), std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count());
+
+        // The other inputs are still processed, but the run as a whole failed
+        if (rdr.failed_files())
+        {
+            printf("Failed to read %llu of the %llu input files\n", (unsigned long long)rdr.failed_files(),
+                (unsigned long long)input_file_names.size());
+            return -1;
+        }
         return 0;
     }
     
 private:
 
-    void process_value(const json::iterator& js, tlv_value& tval, string& stype, string& skey)
+    static void make_directory(const string& dir)
     {
-        skey = js.key();
+#if defined(_WIN32)
+        _mkdir(dir.c_str());
+#else
+        mkdir(dir.c_str(), 0755);
+#endif
+    }
 
-        if (js->is_number_integer())
+    // Output file names for the inputs: "<dir>/<input base name>.tlv", made unique with the input index
+    static vector<string> per_input_output_names(const vector<string>& inputs, const string& dir)
+    {
+        vector<string> names;
+        std::set<string> used;
+        for (size_t i = 0; i < inputs.size(); ++i)
         {
-            if (js.value() >= 0)
+            size_t sep = inputs[i].find_last_of("/\\");
+            string base = string::npos == sep ? inputs[i] : inputs[i].substr(sep + 1);
+            string name = dir + "/" + base + ".tlv";
+            if (!used.insert(name).second)
             {
-                if (js.value() >= std::numeric_limits<uint8_t>::min() && js.value() <= std::numeric_limits<uint8_t>::max())
-                {
-                    stype = "uint8_t";
-                    tval = tlv_value((uint8_t)js.value());
-                }
-                else if (js.value() >= std::numeric_limits<uint16_t>::min() && js.value() <= std::numeric_limits<uint16_t>::max())
-                {
-                    stype = "uint16_t";
-                    tval = tlv_value((uint16_t)js.value());
-                }
-                else if (js.value() >= std::numeric_limits<uint32_t>::min() && js.value() <= std::numeric_limits<uint32_t>::max())
-                {
-                    stype = "uint32_t";
+                name = dir + "/" + base + "." + std::to_string(i) + ".tlv";
+                used.insert(name);
+            }
+            names.push_back(name);
+        }
+        return names;
+    }
 
-                    tval = tlv_value((uint32_t)js.value());
-                }
-                else if (js.value() >= std::numeric_limits<uint64_t>::min() && js.value() <= std::numeric_limits<uint64_t>::max())
-                {
-                    stype = "uint64_t";
+    /**
+      Parse a single record and write its TLV encoding to the output.
+      Returns the reason the record is rejected for, with nothing written, or record_error::none.
+    */
+    record_error process_line(string_view line, tlv_data_serializer& ds)
+    {
+        printf("----------------------------------------------------------------------------------------------------\n");
 
-                    tval = tlv_value((uint64_t)js.value());
-                }
+        // The string TLVs must hold valid UTF-8, the whole line is checked before anything is extracted
+        if (!utf8_validate(line))
+            return record_error::invalid_utf8;
+
+        // The declared record types first, their values keep the declared types
+        for (auto& schema : schemas_)
+        {
+            if (schema->encode(line, ds, input_key_order_, map_key_))
+            {
+                ++schema_records_;
+                trace_record(ds, schema->output_keys(input_key_order_));
+                return record_error::none;
+            }
+        }
+
+        // The flat records take the fast path, the rest goes through the DOM or the SAX parser
+        if (-1 != flat_parser_.parse(line, fields_))
+        {
+            ++flat_records_;
+            process_flat_record(ds);
+            return record_error::none;
+        }
+        ++fallback_records_;
+
+        if (input_key_order_)
+            return process_sax_record(line, ds);
+
+        json jst;
+        //nlohmann::ordered_json jst;
+
+        if (-1 == parse_json_line(line, jst))
+            return record_error::malformed;
+
+        // All the values are checked before any of the keys gets mapped
+        record_error err = check_dom_record(jst);
+        if (record_error::none != err)
+            return err;
+        
+        vector<tlv_value> tlv_vals;
+
+        for (auto it = jst.begin(); it != jst.end(); ++it)
+        {
+            string stype, skey;
+            tlv_value tlv;
+            process_value(it, tlv, stype, skey);
+            add_field(skey, tlv, tlv_vals);
+#if 0
+            if (tlv.type() == tlv_type::TLVT_STRING)
+            {
+                string s = tlv.get_value_as<string>();
+                printf("type: %-5d %-12s key: %-8s value: %-20s mapped_key: %d\n", 
+                                tlv.type(), 
+                                stype.c_str(), 
+                                skey.c_str(),
+                                s.c_str(),
+                                mapped_key
+                                );
             }
             else
             {
-                if (js.value() >= std::numeric_limits<int8_t>::min())
-                {
-                    stype = "int8_t";
-                    tval = tlv_value((int8_t)js.value());
-                }
-                else if (js.value() >= std::numeric_limits<int16_t>::min())
-                {
-                    stype = "int16_t";
-                    tval = tlv_value((int16_t)js.value());
-                }
-                else if (js.value() >= std::numeric_limits<int32_t>::min())
-                {
-                    stype = "int32_t";
-                    tval = tlv_value((int32_t)js.value());
-                }
-                if (js.value() >= std::numeric_limits<int64_t>::min())
+                uint64_t val = tlv.get_value_as<uint8_t>();
+                printf("type: %-5d %-12s key: %-8s value: %-20llu mapped_key: %d\n", 
+                                tlv.type(), 
+                                stype.c_str(), 
+                                skey.c_str(),
+                                val,
+                                mapped_key
+                                );
+
+            }
+#endif           //continue;
+        }
+
+        ds.dump_to_file(tlv_vals);
+        return record_error::none;
+    }
+
+    // Count a rejected record and write it to the quarantine file
+    void reject(string_view input, uint64_t offset, record_error err, string_view line)
+    {
+        printf("Failed to process line (%s) '%.*s'\n", record_error_name(err), (int)line.size(), line.data());
+        quarantine_.add(input, offset, err, line);
+    }
+
+    // Encode the fields just parsed by the flat parser, with the same key order and types as the DOM path
+    void process_flat_record(tlv_data_serializer& ds)
+    {
+        // The key IDs and the output order come from the last record of the same shape, only the
+        // keys it predicts wrong are looked up in the dictionary
+        record_shape& shape = shapes_.predict(fields_);
+        size_t hits = shape.match(fields_, ids_);
+        bool same_shape = hits == fields_.size() && shape.ids.size() == fields_.size();
+        shapes_.count(fields_.size(), hits, same_shape);
+
+        if (!same_shape)
+        {
+            if (input_key_order_)
+            {
+                order_.resize(fields_.size());
+                for (size_t i = 0; i < order_.size(); ++i)
+                    order_[i] = (uint32_t)i;
+            }
+            else
+                flat_record_parser::dom_order(fields_, order_);
+
+            // In the output order, which is the order the new keys get their IDs in
+            for (uint32_t k : order_)
+                if (record_shape::NO_ID == ids_[k])
+                    ids_[k] = get_mapped_key(fields_[k].key);
+
+            shape.store(fields_, ids_, order_);
+        }
+
+        const vector<uint32_t>& order = same_shape ? shape.order : order_;
+
+        // The widths of all the integers of the record, classified in one pass
+        int_bits_.clear();
+        int_negative_.clear();
+        for (uint32_t k : order)
+        {
+            const flat_field& f = fields_[k];
+            if (flat_value_kind::unsigned_integer == f.kind || flat_value_kind::signed_integer == f.kind)
+            {
+                int_bits_.push_back(f.u);
+                int_negative_.push_back(flat_value_kind::signed_integer == f.kind && f.i < 0);
+            }
+        }
+        int_classes_.resize(int_bits_.size());
+        integer_width_classes(int_bits_.data(), int_negative_.data(), int_bits_.size(), int_classes_.data());
+
+        // Encoded straight into the output buffer, no tlv_value per field
+        ds.begin_record();
+        trace_keys_.clear();
+        size_t next_int = 0;
+        for (uint32_t k : order)
+        {
+            const flat_field& f = fields_[k];
+            append_key(ds, ids_[k]);
+            switch (f.kind)
+            {
+            case flat_value_kind::unsigned_integer:
+            case flat_value_kind::signed_integer:
+                ds.append_tlv(encode_integer(int_bits_[next_int], int_negative_[next_int], int_classes_[next_int]));
+                ++next_int;
+                break;
+            case flat_value_kind::floating:
+                ds.append_tlv(encode_floating(f.d));
+                break;
+            case flat_value_kind::string:
+                // The raw bytes straight from the input, only the few strings with escapes are decoded
+                if (f.escaped)
                 {
-                    stype = "int64_t";
-                    tval = tlv_value((int64_t)js.value());
+                    unescape_json_string(f.str, &unescaped_);
+                    ds.append_string_tlv(unescaped_);
                 }
+                else
+                    ds.append_string_tlv(f.str);
+                break;
+            case flat_value_kind::boolean:
+            {
+                uint8_t b = f.b;
+                ds.append_tlv(tlv_type::TLVT_UINT8, &b, sizeof(b));
+                break;
+            }
             }
+            trace_keys_.push_back(f.key);
+        }
+
+        trace_record(ds, trace_keys_);
+    }
+
+    /**
+      Parse a record rejected by the flat parser through the SAX interface, keeping its key order.
+      The handler encodes the fields into the output buffer as they are parsed; a record failing
+      halfway is dropped from the buffer, along with the keys it has added to the dictionary.
+      Returns the reason the record is rejected for or record_error::none.
+    */
+    record_error process_sax_record(string_view line, tlv_data_serializer& ds)
+    {
+        dictionary_value_type key_mark = next_key_;
+        ds.begin_record();
+
+        record_sax_handler handler(*this, ds);
+        if (!json::sax_parse(line.data(), line.data() + line.size(), &handler))
+        {
+            ds.rollback_record();
+            rollback_keys(key_mark);
+            return handler.error();
+        }
+
+        trace_keys_.assign(handler.keys().begin(), handler.keys().end());
+        trace_record(ds, trace_keys_);
+        return record_error::none;
+    }
+
+    /**
+      * SAX handler encoding the fields of a flat record in their input order into the output
+      * buffer, with no DOM and no tlv_value in between. The values nested in the record and the
+      * nulls are rejected as in check_dom_record, by stopping the parse with the reason.
+    */
+    class record_sax_handler
+    {
+    public:
+        using string_t = json::string_t;
+
+        record_sax_handler(json_data_processor& owner, tlv_data_serializer& ds)
+            : owner_(owner)
+            , ds_(ds)
+        {}
+
+        bool null()                                             { return unsupported(record_error::null_value); }
+        bool boolean(bool val)                                  { uint8_t b = val; return add(tlv_type::TLVT_UINT8, &b, sizeof(b)); }
+        bool number_integer(json::number_integer_t val)         { return add(encode_integer((uint64_t)val, val < 0, integer_width_class((uint64_t)val, val < 0))); }
+        bool number_unsigned(json::number_unsigned_t val)       { return add(encode_integer(val, false, integer_width_class(val, false))); }
+        bool number_float(json::number_float_t val, const string_t&) { return add(encode_floating(val)); }
+        bool binary(json::binary_t&)                            { return unsupported(record_error::nested_value); }
+        bool start_array(std::size_t)                           { return unsupported(record_error::nested_value); }
+        bool end_array()                                        { return true; }
+
+        bool string(string_t& val)
+        {
+            if (1 != depth_)
+                return unsupported(record_error::nested_value);
+            ds_.append_string_tlv(val);
+            return true;
+        }
+
+        bool start_object(std::size_t)
+        {
+            if (depth_++ > 0)
+                return unsupported(record_error::nested_value);
+            return true;
+        }
+
+        bool end_object()
+        {
+            --depth_;
+            return true;
+        }
+
+        // The key goes out right away, its value follows it
+        bool key(string_t& val)
+        {
+            owner_.append_key(ds_, owner_.get_mapped_key(val));
+            keys_.emplace_back(std::move(val));
+            return true;
+        }
+
+        bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&)
+        {
+            error_ = record_error::malformed;
+            return false;
+        }
+
+        // The keys of the record, in the order of its fields
+        const vector<string_t>& keys() const
+        {
+            return keys_;
+        }
+
+        record_error error() const
+        {
+            return error_;
+        }
+
+    private:
+
+        bool add(const tlv_scalar& scalar)
+        {
+            return add(scalar.type, scalar.bytes, scalar.size);
+        }
+
+        bool add(tlv_type type, const void* pdata, tlv_value::size_type size)
+        {
+            if (1 != depth_)
+                return unsupported(record_error::nested_value);
+            ds_.append_tlv(type, pdata, size);
+            return true;
+        }
+
+        // Stop the parse, anything met outside an object means the line is not a record
+        bool unsupported(record_error err)
+        {
+            error_ = 0 == depth_ ? record_error::not_an_object : err;
+            return false;
+        }
+
+    private:
+        json_data_processor&    owner_;
+        tlv_data_serializer&    ds_;
+        int                     depth_{0};
+        vector<string_t>        keys_;
+        record_error            error_{record_error::none};
+    };
+
+    // The key of a field as the record holds it, an int32 TLV ahead of the value
+    void append_key(tlv_data_serializer& ds, int32_t mapped_key)
+    {
+        ds.append_tlv(tlv_type::TLVT_INT32, &mapped_key, sizeof(mapped_key));
+    }
+
+    // Print the fields of the record just encoded, as 'add_field' does, from the output buffer
+    void trace_record(const tlv_data_serializer& ds, const vector<string_view>& keys)
+    {
+        string_view rec = ds.record_bytes();
+        const char* p = rec.data();
+        for (string_view key : keys)
+        {
+            int32_t mapped_key;
+            tlv_value::size_type size;
+            memcpy(&mapped_key, p + tlv_data_serializer::TLV_HEADER_SIZE, sizeof(mapped_key));
+            p += tlv_data_serializer::TLV_HEADER_SIZE + sizeof(mapped_key);
+
+            memcpy(&size, p + 1, sizeof(size));
+            printf("%-60s key: %-12.*s mapped key: %d\n", 
+                    tlv_value::string_rep((tlv_type)p[0], p + tlv_data_serializer::TLV_HEADER_SIZE, size).c_str()
+                    , (int)key.size(), key.data()
+                    , mapped_key
+                    );
+            p += tlv_data_serializer::TLV_HEADER_SIZE + size;
+        }
+    }
+
+    // Forget the keys added to the dictionary after 'mark', by a record that failed to parse
+    void rollback_keys(dictionary_value_type mark)
+    {
+        if (next_key_ == mark)
+            return;
+        map_keys_.erase_if([mark](string_view, dictionary_value_type id) { return id > mark; });
+        next_key_ = mark;
+    }
+
+    // Append the mapped key and the value of a field to the record
+    void add_field(string_view skey, const tlv_value& tlv, vector<tlv_value>& tlv_vals)
+    {
+        add_field(skey, get_mapped_key(skey), tlv, tlv_vals);
+    }
+
+    void add_field(string_view skey, int32_t mapped_key, const tlv_value& tlv, vector<tlv_value>& tlv_vals)
+    {
+        tlv_value val_key(mapped_key);
+
+        tlv_vals.push_back(val_key);
+        tlv_vals.push_back(tlv);
+
+        printf("%-60s key: %-12.*s mapped key: %d\n", 
+                tlv.as_string_rep().c_str()
+                , (int)skey.size(), skey.data()
+                , mapped_key
+                );
+    }
+
+    void print_stats(const char* backend, const raw_input_stats& st, double total_seconds)
+    {
+        printf("====================================================================================================\n");
+        // The lines failing the UTF-8 check reach neither parser
+        printf("Records: %llu, by the record schemas: %llu, by the flat parser: %llu (%.1f%%), by the %s parser: %llu\n",
+                (unsigned long long)(schema_records_ + flat_records_ + fallback_records_ + quarantine_.count(record_error::invalid_utf8)),
+                (unsigned long long)schema_records_,
+                (unsigned long long)flat_records_,
+                flat_records_ + fallback_records_ ? 100.0 * flat_records_ / (flat_records_ + fallback_records_) : 0.0,
+                input_key_order_ ? "SAX" : "DOM",
+                (unsigned long long)fallback_records_
+                );
+        printf("Key IDs predicted from the record shapes: %.1f%% of the keys, %.1f%% of the flat records\n",
+                shapes_.keys() ? 100.0 * shapes_.hits() / shapes_.keys() : 0.0,
+                shapes_.records() ? 100.0 * shapes_.record_hits() / shapes_.records() : 0.0
+                );
+        printf("Rejected records: %llu", (unsigned long long)quarantine_.total());
+        for (size_t i = (size_t)record_error::none + 1; i < (size_t)record_error::count; ++i)
+            printf("%s %s: %llu", i == (size_t)record_error::none + 1 ? " -" : ",",
+                    record_error_name((record_error)i), (unsigned long long)quarantine_.count((record_error)i));
+        if (quarantine_.is_open())
+            printf(" (written to '%s')", quarantine_.name().c_str());
+        printf("\n");
+        printf("Input (%s): %llu bytes in %llu chunks, total time: %.3f s, waited for input: %.3f s (%.1f%%) - %s bound\n",
+                backend,
+                (unsigned long long)st.bytes,
+                (unsigned long long)st.chunks,
+                total_seconds,
+                st.wait_seconds,
+                total_seconds > 0 ? 100.0 * st.wait_seconds / total_seconds : 0.0,
+                st.wait_seconds * 2 > total_seconds ? "I/O" : "CPU"
+                );
+    }
+
+    // The DOM counterpart of the checks of record_sax_handler
+    static record_error check_dom_record(const json& jst)
+    {
+        if (!jst.is_object())
+            return record_error::not_an_object;
+
+        for (const json& val : jst)
+        {
+            if (val.is_null())
+                return record_error::null_value;
+            if (val.is_structured() || val.is_binary())
+                return record_error::nested_value;
+        }
+        return record_error::none;
+    }
+
+    // The value must have passed check_dom_record
+    void process_value(const json::iterator& js, tlv_value& tval, string& stype, string& skey)
+    {
+        skey = js.key();
+
+        if (js->is_number_integer())
+        {
+            // Read the stored number once, its width follows from the count of its significant bits
+            static const char* const type_names[2][4] = {
+                { "uint8_t", "uint16_t", "uint32_t", "uint64_t" },
+                { "int8_t", "int16_t", "int32_t", "int64_t" }
+            };
+
+            const json::number_unsigned_t* punsigned = js->get_ptr<const json::number_unsigned_t*>();
+            uint64_t bits = punsigned ? *punsigned : (uint64_t)*js->get_ptr<const json::number_integer_t*>();
+            bool negative = !punsigned && (int64_t)bits < 0;
+
+            unsigned width = integer_width_class(bits, negative);
+            stype = type_names[negative][width];
+            tval = tlv_value::from_integer(bits, negative, width);
         }
         else if (js->is_number_float())
         {
             stype = "float";
-            tval = tlv_value((double)js.value());
+            tval = tlv_value::from_floating(*js->get_ptr<const json::number_float_t*>());
         }
         else if (js->is_string())
         {
             stype = "string";
-            tval = tlv_value(string(js.value()));
+            tval = tlv_value::from_string(*js->get_ptr<const json::string_t*>());
         }
         else if (js->is_boolean())
         {
@@ -202,38 +841,125 @@ private:
         }
     }
 
-    int parse_json_line(const string& line, json& jst)
+    int parse_json_line(string_view line, json& jst)
+    {
+        // Parse straight from the reader's bytes, no intermediate copy of the line. A malformed
+        // line comes back as a discarded value instead of an exception.
+        jst = json::parse(line.data(), line.data() + line.size(), nullptr, false);
+        if (jst.is_discarded())
+            return -1;
+
+        //printf("successfully processed: '%s'\n", line.c_str());
+        return 0;
+    }
+
+    // Not a thread-safe implementation.
+    dictionary_value_type get_mapped_key(string_view key)
+    {
+        dictionary_value_type base_id;
+        if (base_keys_.is_open() && base_keys_.find(key, base_id))
+            return base_id;
+
+        // A single probe sequence, which also finds the slot of a new key
+        auto [id, added] = map_keys_.try_emplace(key, next_key_ + 1);
+        if (added)
+            ++next_key_;
+        return id;
+    }
+
+    // The whole dictionary: the keys of the preloaded image, if any, together with those added since
+    const key_dictionary& all_keys()
+    {
+        if (!base_keys_.is_open())
+            return map_keys_;
+
+        merged_keys_ = map_keys_;
+        merged_keys_.reserve(map_keys_.size() + base_keys_.size());
+        base_keys_.for_each([this](string_view key, dictionary_value_type id) { merged_keys_.assign(key, id); });
+        return merged_keys_;
+    }
+
+    // Write the dictionary outputs that are set
+    int save_dictionary()
     {
-        try
+        if (!dict_out_name_.empty())
         {
-            jst = json::parse(line);
+            tlv_data_serializer ds;
+            if (-1 == ds.init(dict_out_name_))
+            {
+                printf("Failed to open the dictionary output file: '%s'\n", dict_out_name_.c_str());
+                return -1;
+            }
+            ds.dump_map(all_keys());
         }
-        catch (const runtime_error& e)
+
+        if (!dict_image_name_.empty() && -1 == dictionary_image::write(dict_image_name_, all_keys()))
         {
-            printf("Exception: %s\n", e.what());
+            printf("Failed to write the dictionary image file: '%s'\n", dict_image_name_.c_str());
             return -1;
         }
-
-        //printf("successfully processed: '%s'\n", line.c_str());
         return 0;
     }
 
-    // Not a thread-safe implementation.
-    dictionary_value_type get_mapped_key(const string& skey)
+    void save_checkpoint(checkpoint_file& ckpt, tlv_data_serializer& ds, uint64_t input_offset)
     {
-        static dictionary_value_type nxt_key = 0;
-        
-        if (map_keys_.find(skey) != map_keys_.end())
-            return map_keys_[skey];
+        // The output up to the recorded offset must be on disk before the checkpoint refers to it
+        ds.sync();
+        quarantine_.sync();
 
-        ++nxt_key;
-        map_keys_[skey] = nxt_key;
-        return nxt_key;
+        checkpoint_state st;
+        st.input_offset = input_offset;
+        st.output_offset = ds.tell();
+        st.quarantine_offset = quarantine_.tell();
+        st.next_key = next_key_;
+        st.keys = all_keys();
+        if (-1 == ckpt.save(st))
+            printf("Failed to write the checkpoint file: '%s'\n", ckpt.name().c_str());
     }
 
 private:
 
-    map<string, dictionary_value_type> map_keys_;
+    key_dictionary map_keys_;
+    dictionary_value_type next_key_{0};
+
+    // The preloaded dictionary image, looked up in place ahead of map_keys_, see 'load_dictionary'
+    dictionary_image base_keys_;
+    key_dictionary merged_keys_;
+
+    // The dictionary outputs, see 'set_dictionary_output' and 'set_dictionary_image_output'
+    string dict_out_name_;
+    string dict_image_name_;
+
+    // Fast path parser and its reusable field list
+    flat_record_parser flat_parser_;
+    vector<flat_field> fields_;
+
+    // Predicted key IDs and the output order of the flat records
+    record_shape_cache shapes_;
+    vector<dictionary_value_type> ids_;
+    vector<uint32_t> order_;
+    vector<uint64_t> int_bits_;
+    vector<uint8_t> int_negative_;
+    vector<uint8_t> int_classes_;
+    string unescaped_;
+    vector<string_view> trace_keys_;
+
+    // The declared record types, see 'add_record_schema'
+    vector<std::unique_ptr<record_schema_base>> schemas_;
+    record_schema_base::key_mapper map_key_{[this](string_view key) { return get_mapped_key(key); }};
+    uint64_t schema_records_{0};
+
+    // The rejected records, see 'set_quarantine'
+    record_quarantine quarantine_;
+    uint64_t flat_records_{0};
+    uint64_t fallback_records_{0};
+
+    // Records keep the input order of their keys, see 'set_input_key_order'
+    bool input_key_order_{false};
+
+    // Checkpointing, see 'set_checkpointing'
+    uint64_t checkpoint_interval_{0};
+    bool resume_{false};
 };
 
 #endif // JSON_DATA_PROCESSOR_HEADER
@@ -0,0 +1,263 @@
+#ifndef DECOMPRESS_SOURCE_HEADER
+#define DECOMPRESS_SOURCE_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include "json_raw_data_source.h"
+
+#if defined(JSON_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#if defined(JSON_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+/**
+  * Compression formats of the input, told apart by their magic bytes.
+*/
+enum class raw_compression
+{
+    none,
+    gzip,
+    zstd
+};
+
+/**
+  Peek at the first bytes of the file and tell its compression format.
+  Returns 'none' for the plain files and for the ones that cannot be read.
+*/
+inline raw_compression detect_compression(const std::string& fname)
+{
+    unsigned char magic[4] = { 0 };
+
+    FILE* pf = fopen(fname.c_str(), "rb");
+    if (!pf)
+        return raw_compression::none;
+    size_t rv = fread(magic, 1, sizeof(magic), pf);
+    fclose(pf);
+
+    if (rv >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+        return raw_compression::gzip;
+    if (rv >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+        return raw_compression::zstd;
+    return raw_compression::none;
+}
+
+// Whether this build can decompress the given format
+inline bool compression_supported(raw_compression comp)
+{
+    switch (comp)
+    {
+    case raw_compression::none:
+        return true;
+#if defined(JSON_HAVE_ZLIB)
+    case raw_compression::gzip:
+        return true;
+#endif
+#if defined(JSON_HAVE_ZSTD)
+    case raw_compression::zstd:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+inline const char* compression_name(raw_compression comp)
+{
+    switch (comp)
+    {
+    case raw_compression::gzip:
+        return "gzip";
+    case raw_compression::zstd:
+        return "zstd";
+    default:
+        return "none";
+    }
+}
+
+/**
+  * Streaming decompression of a gzip or zstd compressed file.
+  * The compressed file is read in chunks through a file source and inflated straight into the
+  * buffers passed to 'read_into', so it can be run on the read-ahead thread to overlap the
+  * decompression with the parsing. Multi-member gzip files and multi-frame zstd files are supported,
+  * an input ending in the middle of a member or frame is a read error.
+*/
+class raw_decompress_source : public raw_stream_source
+{
+public:
+    raw_decompress_source() = default;
+    ~raw_decompress_source() override { close(); }
+
+    int open(const string& fname, raw_compression comp, size_t chunk_size = DEFAULT_CHUNK_SIZE)
+    {
+        close();
+
+        if (!compression_supported(comp) || comp == raw_compression::none)
+            return -1;
+
+        if (-1 == src_.open(fname, chunk_size))
+            return -1;
+
+        comp_ = comp;
+        in_buf_.reset(new char[chunk_size]);
+        in_size_ = chunk_size;
+        in_pos_ = in_len_ = 0;
+        in_eof_ = false;
+        in_frame_ = false;
+        set_chunk_size(chunk_size);
+
+#if defined(JSON_HAVE_ZLIB)
+        if (comp_ == raw_compression::gzip)
+        {
+            memset(&zs_, 0, sizeof(zs_));
+            // 15 window bits, +16 for the gzip wrapper only
+            if (Z_OK != inflateInit2(&zs_, 15 + 16))
+                return -1;
+            zs_init_ = true;
+        }
+#endif
+#if defined(JSON_HAVE_ZSTD)
+        if (comp_ == raw_compression::zstd)
+        {
+            if (!(zds_ = ZSTD_createDStream()))
+                return -1;
+            ZSTD_initDStream(zds_);
+        }
+#endif
+        return 0;
+    }
+
+    void close()
+    {
+#if defined(JSON_HAVE_ZLIB)
+        if (zs_init_)
+            inflateEnd(&zs_);
+        zs_init_ = false;
+#endif
+#if defined(JSON_HAVE_ZSTD)
+        if (zds_)
+            ZSTD_freeDStream(zds_);
+        zds_ = nullptr;
+#endif
+        src_.close();
+        comp_ = raw_compression::none;
+    }
+
+    size_t read_into(char* buf, size_t size) override
+    {
+        size_t out_len = 0;
+
+        // Fill the whole output buffer, unless the input ends first
+        while (out_len < size)
+        {
+            if (in_pos_ == in_len_ && !in_eof_)
+            {
+                in_len_ = src_.read_into(in_buf_.get(), in_size_);
+                in_pos_ = 0;
+                in_eof_ = (0 == in_len_);
+            }
+
+            // The decoder may still hold output of the last frame when the input is used up
+            if (in_pos_ == in_len_ && in_eof_ && !in_frame_)
+                break;
+
+            size_t produced = 0;
+            switch (comp_)
+            {
+#if defined(JSON_HAVE_ZLIB)
+            case raw_compression::gzip:
+                produced = inflate_some(buf + out_len, size - out_len);
+                break;
+#endif
+#if defined(JSON_HAVE_ZSTD)
+            case raw_compression::zstd:
+                produced = zstd_some(buf + out_len, size - out_len);
+                break;
+#endif
+            default:
+                throw (std::runtime_error("No open input file to read"));
+            }
+            out_len += produced;
+
+            if (0 == produced && in_frame_ && in_pos_ == in_len_ && in_eof_)
+                throw (std::runtime_error(string("The ") + compression_name(comp_) + " input ends in the middle of a " +
+                    (comp_ == raw_compression::gzip ? "member" : "frame") + ", the file is truncated"));
+        }
+
+        return out_len;
+    }
+
+    const char* name() const override
+    {
+        return compression_name(comp_);
+    }
+
+private:
+
+#if defined(JSON_HAVE_ZLIB)
+    size_t inflate_some(char* out, size_t size)
+    {
+        zs_.next_in = (Bytef*)(in_buf_.get() + in_pos_);
+        zs_.avail_in = (uInt)(in_len_ - in_pos_);
+        zs_.next_out = (Bytef*)out;
+        zs_.avail_out = (uInt)size;
+
+        int rv = inflate(&zs_, Z_NO_FLUSH);
+        if (rv != Z_OK && rv != Z_STREAM_END && rv != Z_BUF_ERROR)
+            throw (std::runtime_error(string("Error decompressing the gzip input: ") + (zs_.msg ? zs_.msg : "corrupt data")));
+
+        in_pos_ = in_len_ - zs_.avail_in;
+
+        // Another gzip member may follow the one just finished
+        in_frame_ = (Z_STREAM_END != rv);
+        if (!in_frame_)
+            inflateReset(&zs_);
+
+        return size - zs_.avail_out;
+    }
+#endif
+
+#if defined(JSON_HAVE_ZSTD)
+    size_t zstd_some(char* out, size_t size)
+    {
+        ZSTD_inBuffer in = { in_buf_.get(), in_len_, in_pos_ };
+        ZSTD_outBuffer ob = { out, size, 0 };
+
+        size_t rv = ZSTD_decompressStream(zds_, &ob, &in);
+        if (ZSTD_isError(rv))
+            throw (std::runtime_error(string("Error decompressing the zstd input: ") + ZSTD_getErrorName(rv)));
+
+        // Zero once the frame is complete and all of its output flushed
+        in_frame_ = (0 != rv);
+        in_pos_ = in.pos;
+        return ob.pos;
+    }
+#endif
+
+private:
+    raw_file_source         src_;
+    raw_compression         comp_{raw_compression::none};
+
+    // Compressed input
+    std::unique_ptr<char[]> in_buf_;
+    size_t                  in_size_{0};
+    size_t                  in_pos_{0};
+    size_t                  in_len_{0};
+    bool                    in_eof_{false};
+    bool                    in_frame_{false};   // Inside a gzip member or zstd frame that has not ended yet
+
+#if defined(JSON_HAVE_ZLIB)
+    z_stream                zs_;
+    bool                    zs_init_{false};
+#endif
+#if defined(JSON_HAVE_ZSTD)
+    ZSTD_DStream*           zds_{nullptr};
+#endif
+};
+
+#endif // DECOMPRESS_SOURCE_HEADER
@@ -0,0 +1,374 @@
+#ifndef JSON_DICTIONARY_IMAGE_HEADER
+#define JSON_DICTIONARY_IMAGE_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "json_key_dictionary.h"
+#include "json_common.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/**
+  * The header of a dictionary image file. All the fields are in the byte order of the writer, as
+  * in the TLV output, and every section starts at a multiple of 8.
+*/
+struct dictionary_image_header
+{
+    static constexpr char MAGIC[8] = { 'T', 'L', 'V', 'D', 'I', 'C', 'T', 0 };
+    static constexpr uint32_t VERSION = 1;
+
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    key_count;
+    uint32_t    id_count;           // Entries of the ID table: the highest ID + 1
+    uint32_t    slot_count;         // Entries of the hash table, a power of two
+    uint64_t    file_size;
+    uint64_t    id_table_offset;
+    uint64_t    slot_table_offset;
+    uint64_t    keys_offset;
+    uint32_t    checksum;           // CRC32C of the bytes that follow the header
+    uint32_t    reserved;
+};
+
+/**
+  * A key dictionary laid out to be used in place once mapped into memory, so that preloading it
+  * (see json_data_processor::load_dictionary) costs one mmap and a checking pass instead of a map
+  * insertion per key: the encoder looks the preloaded keys up with 'find' right in the image, and
+  * a decoder would turn the IDs back into keys with 'key'.
+  * After the header come:
+  *   - the ID table, a uint32 per ID from 0 to the highest one: the file offset of the key record
+  *     of the ID, or 0 for an unused ID, for the decoding;
+  *   - the hash table, a (uint32 hash, uint32 key record offset) pair per slot: the keys by their
+  *     CRC32C (0 read as 1, 0 marking the empty slots), linearly probed, at most half full, for the
+  *     encoding;
+  *   - the key records sorted by the key bytes, each an int32 ID, a uint32 size and the key bytes
+  *     with a terminating NUL, padded to a multiple of 4.
+*/
+class dictionary_image
+{
+public:
+    using string = std::string;
+    using string_view = std::string_view;
+
+    dictionary_image() = default;
+    dictionary_image(const dictionary_image&) = delete;
+    dictionary_image& operator=(const dictionary_image&) = delete;
+    ~dictionary_image() { close(); }
+
+    /**
+      Write 'keys' as a dictionary image to 'fname'.
+      Returns -1 if the file cannot be written or an ID is negative.
+    */
+    static int write(const string& fname, const key_dictionary& keys)
+    {
+        std::vector<key_dictionary::entry> entries = keys.sorted_entries();
+
+        uint32_t id_count = 1;
+        for (auto& [key, id] : entries)
+        {
+            if (id < 0)
+                return -1;
+            id_count = std::max(id_count, (uint32_t)id + 1);
+        }
+        uint32_t slot_count = 16;
+        while (slot_count < 2 * entries.size())
+            slot_count *= 2;
+
+        dictionary_image_header hdr{};
+        memcpy(hdr.magic, dictionary_image_header::MAGIC, sizeof(hdr.magic));
+        hdr.version = dictionary_image_header::VERSION;
+        hdr.key_count = (uint32_t)entries.size();
+        hdr.id_count = id_count;
+        hdr.slot_count = slot_count;
+        hdr.id_table_offset = sizeof(hdr);
+        hdr.slot_table_offset = align8(hdr.id_table_offset + (uint64_t)id_count * sizeof(uint32_t));
+        hdr.keys_offset = align8(hdr.slot_table_offset + (uint64_t)slot_count * sizeof(image_slot));
+
+        uint64_t size = hdr.keys_offset;
+        for (auto& [key, id] : entries)
+            size += record_size(key.size());
+        hdr.file_size = size;
+        if (size > UINT32_MAX)
+            return -1;
+
+        std::vector<char> image(size);
+        uint32_t* ids = (uint32_t*)(image.data() + hdr.id_table_offset);
+        image_slot* slots = (image_slot*)(image.data() + hdr.slot_table_offset);
+
+        uint64_t offset = hdr.keys_offset;
+        for (auto& [key, id] : entries)
+        {
+            int32_t rec_id = id;
+            uint32_t rec_size = (uint32_t)key.size();
+            memcpy(image.data() + offset, &rec_id, sizeof(rec_id));
+            memcpy(image.data() + offset + 4, &rec_size, sizeof(rec_size));
+            memcpy(image.data() + offset + 8, key.data(), key.size());
+
+            ids[id] = (uint32_t)offset;
+
+            uint32_t hash = hash_of(key);
+            uint32_t pos = hash & (slot_count - 1);
+            while (slots[pos].hash)
+                pos = (pos + 1) & (slot_count - 1);
+            slots[pos].hash = hash;
+            slots[pos].offset = (uint32_t)offset;
+
+            offset += record_size(key.size());
+        }
+
+        hdr.checksum = crc32c(string_view(image.data() + sizeof(hdr), size - sizeof(hdr)));
+        memcpy(image.data(), &hdr, sizeof(hdr));
+
+        FILE* pf = fopen(fname.c_str(), "wb");
+        if (!pf)
+            return -1;
+        bool ok = 1 == fwrite(image.data(), image.size(), 1, pf);
+        return 0 == fclose(pf) && ok ? 0 : -1;
+    }
+
+    /**
+      Map the image file 'fname' and check its header, its section bounds and, with 'verify', its
+      checksum and its key records (see 'check_records'). Where mmap is not available the file is
+      read into memory instead.
+      Returns -1 if the file cannot be read or is not a valid dictionary image.
+    */
+    int open(const string& fname, bool verify = true)
+    {
+        close();
+        if (-1 == map_file(fname))
+            return -1;
+
+        if (size_ < sizeof(dictionary_image_header))
+            return fail();
+        memcpy(&hdr_, base_, sizeof(hdr_));
+        if (0 != memcmp(hdr_.magic, dictionary_image_header::MAGIC, sizeof(hdr_.magic))
+            || dictionary_image_header::VERSION != hdr_.version || size_ != hdr_.file_size
+            || 0 == hdr_.slot_count || 0 != (hdr_.slot_count & (hdr_.slot_count - 1)) || hdr_.key_count >= hdr_.slot_count
+            || hdr_.id_table_offset < sizeof(hdr_) || hdr_.id_table_offset + (uint64_t)hdr_.id_count * sizeof(uint32_t) > size_
+            || hdr_.slot_table_offset < sizeof(hdr_) || hdr_.slot_table_offset + (uint64_t)hdr_.slot_count * sizeof(image_slot) > size_
+            || hdr_.keys_offset > size_)
+            return fail();
+        // The IDs are used as dictionary_value_type
+        if (0 == hdr_.id_count || hdr_.id_count - 1 > (uint32_t)std::numeric_limits<dictionary_value_type>::max())
+            return fail();
+        if (verify && (hdr_.checksum != crc32c(string_view(base_ + sizeof(hdr_), size_ - sizeof(hdr_))) || !check_records()))
+            return fail();
+        return 0;
+    }
+
+    // The file starts as a dictionary image, valid or not
+    static bool is_image_file(const string& fname)
+    {
+        char magic[sizeof(dictionary_image_header::MAGIC)];
+        FILE* pf = fopen(fname.c_str(), "rb");
+        if (!pf)
+            return false;
+        bool rv = 1 == fread(magic, sizeof(magic), 1, pf) && 0 == memcmp(magic, dictionary_image_header::MAGIC, sizeof(magic));
+        fclose(pf);
+        return rv;
+    }
+
+    void close()
+    {
+#if !defined(_WIN32)
+        if (base_)
+            munmap((void*)base_, size_);
+#endif
+        buf_.clear();
+        base_ = nullptr;
+        size_ = 0;
+        hdr_ = dictionary_image_header{};
+    }
+
+    bool is_open() const        { return nullptr != base_; }
+    size_t size() const         { return hdr_.key_count; }
+
+    // The highest ID in use, 0 for an empty dictionary
+    dictionary_value_type last_id() const
+    {
+        return is_open() ? (dictionary_value_type)(hdr_.id_count - 1) : 0;
+    }
+
+    // The ID of 'key', for the encoding. Returns false if the key is not present.
+    bool find(string_view key, dictionary_value_type& id) const
+    {
+        const uint32_t mask = hdr_.slot_count - 1;
+        uint32_t hash = hash_of(key);
+        // Bounded by the table size too, as the slots of an unverified image may all be taken
+        for (uint32_t n = 0, pos = hash & mask; n < hdr_.slot_count; ++n, pos = (pos + 1) & mask)
+        {
+            image_slot s;
+            memcpy(&s, base_ + hdr_.slot_table_offset + pos * sizeof(image_slot), sizeof(s));
+            if (!s.hash)
+                return false;
+            if (s.hash == hash)
+            {
+                string_view rec_key;
+                int32_t rec_id;
+                if (read_record(s.offset, rec_key, rec_id) && rec_key == key)
+                {
+                    id = (dictionary_value_type)rec_id;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // The key of 'id', for the decoding. Returns false if the ID is not used.
+    bool key(dictionary_value_type id, string_view& key) const
+    {
+        if (id < 0 || (uint32_t)id >= hdr_.id_count)
+            return false;
+        uint32_t offset;
+        memcpy(&offset, base_ + hdr_.id_table_offset + (size_t)id * sizeof(uint32_t), sizeof(offset));
+        int32_t rec_id;
+        return 0 != offset && read_record(offset, key, rec_id);
+    }
+
+    /**
+      Call 'fn(key, id)' for each key, in the key order, e.g. to load the image into a key_dictionary.
+      Returns -1 if a key record is malformed.
+    */
+    template <typename Fn>
+    int for_each(Fn fn) const
+    {
+        uint64_t offset = hdr_.keys_offset;
+        for (uint32_t i = 0; i < hdr_.key_count; ++i)
+        {
+            string_view rec_key;
+            int32_t rec_id;
+            if (offset > UINT32_MAX || !read_record((uint32_t)offset, rec_key, rec_id))
+                return -1;
+            fn(rec_key, (dictionary_value_type)rec_id);
+            offset += record_size(rec_key.size());
+        }
+        return 0;
+    }
+
+private:
+
+    struct image_slot
+    {
+        uint32_t    hash;
+        uint32_t    offset;
+    };
+
+    static uint64_t align8(uint64_t n)
+    {
+        return (n + 7) & ~(uint64_t)7;
+    }
+
+    // The ID and the size ahead of the bytes, then the NUL and the padding
+    static uint64_t record_size(size_t key_size)
+    {
+        return (8 + key_size + 1 + 3) & ~(uint64_t)3;
+    }
+
+    static uint32_t hash_of(string_view key)
+    {
+        uint32_t h = crc32c(key);
+        return h ? h : 1;
+    }
+
+    /**
+      Every key record is in bounds and is the one the ID table gives for its ID, so that no two
+      keys share an ID, and each is found through the hash table. A pass over the records, with
+      no insertion anywhere.
+    */
+    bool check_records() const
+    {
+        uint64_t offset = hdr_.keys_offset;
+        for (uint32_t i = 0; i < hdr_.key_count; ++i)
+        {
+            string_view rec_key;
+            int32_t rec_id;
+            uint32_t id_offset;
+            dictionary_value_type found;
+            if (offset > UINT32_MAX || !read_record((uint32_t)offset, rec_key, rec_id)
+                || rec_id < 0 || (uint32_t)rec_id >= hdr_.id_count)
+                return false;
+            memcpy(&id_offset, base_ + hdr_.id_table_offset + (size_t)rec_id * sizeof(uint32_t), sizeof(id_offset));
+            if (id_offset != offset || !find(rec_key, found) || found != rec_id)
+                return false;
+            offset += record_size(rec_key.size());
+        }
+        return true;
+    }
+
+    bool read_record(uint32_t offset, string_view& key, int32_t& id) const
+    {
+        uint32_t key_size;
+        if (offset < hdr_.keys_offset || (uint64_t)offset + 8 > size_)
+            return false;
+        memcpy(&id, base_ + offset, sizeof(id));
+        memcpy(&key_size, base_ + offset + 4, sizeof(key_size));
+        if ((uint64_t)offset + 8 + key_size >= size_)
+            return false;
+        key = string_view(base_ + offset + 8, key_size);
+        return true;
+    }
+
+    int map_file(const string& fname)
+    {
+#if !defined(_WIN32)
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if (-1 == fd)
+            return -1;
+
+        struct stat st;
+        if (-1 == fstat(fd, &st) || 0 == st.st_size)
+        {
+            ::close(fd);
+            return -1;
+        }
+
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (MAP_FAILED == p)
+            return -1;
+        base_ = (const char*)p;
+        size_ = (size_t)st.st_size;
+        return 0;
+#else
+        FILE* pf = fopen(fname.c_str(), "rb");
+        if (!pf)
+            return -1;
+        char chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), pf)) > 0)
+            buf_.insert(buf_.end(), chunk, chunk + n);
+        fclose(pf);
+        if (buf_.empty())
+            return -1;
+        base_ = buf_.data();
+        size_ = buf_.size();
+        return 0;
+#endif
+    }
+
+    int fail()
+    {
+        close();
+        return -1;
+    }
+
+private:
+    const char*                 base_{nullptr};
+    size_t                      size_{0};
+    std::vector<char>           buf_;       // The file contents where it is not mapped
+    dictionary_image_header     hdr_{};
+};
+
+#endif // JSON_DICTIONARY_IMAGE_HEADER
@@ -0,0 +1,39 @@
+#ifndef JSON_FEED_SCHEMAS_HEADER
+#define JSON_FEED_SCHEMAS_HEADER
+
+#include <stdint.h>
+#include <string>
+#include "json_record_schema.h"
+#include "json_data_processor.h"
+
+/**
+  * The record types of the known feeds, to be selected by their names on the command line.
+  * A new feed takes its TLV_RECORD declaration here and a line in 'add_feed_schema'.
+*/
+namespace feed_schemas
+{
+    using std::string;
+
+    TLV_RECORD(order, (id, uint64_t), (sym, string), (px, double))
+    TLV_RECORD(trade, (id, uint64_t), (sym, string), (px, double), (qty, uint32_t), (buy, bool))
+    TLV_RECORD(quote, (ts, uint64_t), (sym, string), (bid, double), (ask, double))
+}
+
+/**
+  Add the record type of the feed 'name' to the processor.
+  Returns -1 if there is no such feed.
+*/
+inline int add_feed_schema(json_data_processor& dp, const std::string& name)
+{
+    if (name == "order")
+        dp.add_record_schema<feed_schemas::order>();
+    else if (name == "trade")
+        dp.add_record_schema<feed_schemas::trade>();
+    else if (name == "quote")
+        dp.add_record_schema<feed_schemas::quote>();
+    else
+        return -1;
+    return 0;
+}
+
+#endif // JSON_FEED_SCHEMAS_HEADER
@@ -0,0 +1,396 @@
+#ifndef JSON_FLAT_PARSER_HEADER
+#define JSON_FLAT_PARSER_HEADER
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "json_structural_index.h"
+
+/**
+  * Kinds of the scalar values of a flat record, as the JSON grammar tells them apart.
+*/
+enum class flat_value_kind
+{
+    unsigned_integer,   // An integer without the minus sign
+    signed_integer,     // An integer with the minus sign
+    floating,           // A number with a fraction or an exponent
+    string,
+    boolean
+};
+
+/**
+  * A key of a flat record with its scalar value. The key and the string values are views into
+  * the parsed line.
+*/
+struct flat_field
+{
+    std::string_view    key;
+    flat_value_kind     kind{flat_value_kind::boolean};
+    bool                escaped{false}; // The string value holds escape sequences, 'str' is the raw text
+    union
+    {
+        uint64_t        u;
+        int64_t         i;
+        double          d;
+        bool            b;
+    };
+    std::string_view    str;
+};
+
+/**
+  Decode the escape sequences of the body of a JSON string (the text between its quotes) into 'out',
+  as UTF-8. With a null 'out' the escapes are only checked. A \u escape of a UTF-16 surrogate must
+  come in a high and low pair, as the generic parser requires.
+  Returns -1 on a malformed escape sequence.
+*/
+inline int unescape_json_string(std::string_view in, std::string* out)
+{
+    auto hex4 = [](const char* p, uint32_t& cp)
+    {
+        cp = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            char c = p[i];
+            uint32_t d = c >= '0' && c <= '9' ? c - '0' : (c | 0x20) >= 'a' && (c | 0x20) <= 'f' ? (c | 0x20) - 'a' + 10 : 16;
+            if (16 == d)
+                return false;
+            cp = cp << 4 | d;
+        }
+        return true;
+    };
+
+    if (out)
+        out->clear();
+
+    const char* p = in.data();
+    const char* end = p + in.size();
+    while (p != end)
+    {
+        // Copy the run up to the next escape in one go
+        const char* bs = (const char*)memchr(p, '\\', end - p);
+        if (!bs)
+            bs = end;
+        if (out)
+            out->append(p, bs - p);
+        if (bs == end)
+            break;
+
+        p = bs + 1;
+        if (p == end)
+            return -1;
+
+        char c = *p++;
+        switch (c)
+        {
+        case '"': case '\\': case '/':
+            break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u':
+        {
+            uint32_t cp;
+            if (end - p < 4 || !hex4(p, cp))
+                return -1;
+            p += 4;
+            if (cp >= 0xdc00 && cp <= 0xdfff)
+                return -1;
+            if (cp >= 0xd800 && cp <= 0xdbff)
+            {
+                uint32_t low;
+                if (end - p < 6 || '\\' != p[0] || 'u' != p[1] || !hex4(p + 2, low) || low < 0xdc00 || low > 0xdfff)
+                    return -1;
+                p += 6;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+            }
+
+            if (!out)
+                continue;
+            if (cp < 0x80)
+                out->push_back((char)cp);
+            else if (cp < 0x800)
+            {
+                out->push_back((char)(0xc0 | cp >> 6));
+                out->push_back((char)(0x80 | (cp & 0x3f)));
+            }
+            else if (cp < 0x10000)
+            {
+                out->push_back((char)(0xe0 | cp >> 12));
+                out->push_back((char)(0x80 | (cp >> 6 & 0x3f)));
+                out->push_back((char)(0x80 | (cp & 0x3f)));
+            }
+            else
+            {
+                out->push_back((char)(0xf0 | cp >> 18));
+                out->push_back((char)(0x80 | (cp >> 12 & 0x3f)));
+                out->push_back((char)(0x80 | (cp >> 6 & 0x3f)));
+                out->push_back((char)(0x80 | (cp & 0x3f)));
+            }
+            continue;
+        }
+        default:
+            return -1;
+        }
+        if (out)
+            out->push_back(c);
+    }
+
+    return 0;
+}
+
+/**
+  * Parser of the flat records: a JSON object per line, all of whose values are numbers, strings or
+  * booleans. It is the fast path in front of the generic DOM parser: the keys and the strings are
+  * handed out as views into the line and the numbers are converted in place, so nothing is
+  * allocated once the vectors have grown to the record size.
+  * The line is first indexed by the vectorized structural_indexer; the parser then walks the
+  * structural positions, only the scalars (numbers and literals) are looked at byte by byte.
+  * The string values with escape sequences are only checked here and left raw, flagged 'escaped',
+  * for the encoder to decode with unescape_json_string; the others are written out as they are.
+  * The line must be valid UTF-8 (see utf8_validate), the non-ASCII bytes of the strings are
+  * taken as they are.
+  * Whatever it does not handle is rejected, for the generic parser to deal with: the nested
+  * values and nulls, the keys with escape sequences, the control characters in the strings, the
+  * integers out of the 64-bit range and the malformed lines.
+*/
+class flat_record_parser
+{
+public:
+    using string_view = std::string_view;
+
+    /**
+      Parse 'line' into 'fields', in the order of the input.
+      Returns the number of the fields or -1 if the line is rejected.
+    */
+    int parse(string_view line, std::vector<flat_field>& fields)
+    {
+        fields.clear();
+
+        int count = indexer_.index(line, pos_);
+        if (-1 == count || indexer_.string_controls())
+            return -1;
+        // Only then do the strings need a look for their backslashes
+        const bool escapes = indexer_.string_escapes();
+
+        const char* s = line.data();
+        const size_t n = (size_t)count;
+
+        // Anything before the opening or after the closing brace would be a structural position too
+        if (n < 2 || '{' != s[pos_[0]] || '}' != s[pos_[n - 1]])
+            return -1;
+        if (2 == n)
+            return 0;
+
+        for (size_t i = 1; ; )
+        {
+            // The key: its quotes and the colon
+            if (i + 3 >= n || '"' != s[pos_[i]] || '"' != s[pos_[i + 1]] || ':' != s[pos_[i + 2]])
+                return -1;
+
+            flat_field f;
+            f.key = string_view(s + pos_[i] + 1, pos_[i + 1] - pos_[i] - 1);
+            if (escapes && memchr(f.key.data(), '\\', f.key.size()))
+                return -1;
+            i += 3;
+
+            // The value: a string or a scalar running up to the next structural position
+            const char* v = s + pos_[i];
+            if ('"' == *v)
+            {
+                if (i + 1 >= n || '"' != s[pos_[i + 1]])
+                    return -1;
+                f.kind = flat_value_kind::string;
+                f.str = string_view(v + 1, pos_[i + 1] - pos_[i] - 1);
+                if (escapes && memchr(f.str.data(), '\\', f.str.size()))
+                {
+                    if (-1 == unescape_json_string(f.str, nullptr))
+                        return -1;
+                    f.escaped = true;
+                }
+                i += 2;
+            }
+            else
+            {
+                if (i + 1 >= n)
+                    return -1;
+                const char* next = s + pos_[i + 1];
+                if (!parse_value(v, next, f))
+                    return -1;
+                skip_ws(v, next);
+                if (v != next)
+                    return -1;
+                i += 1;
+            }
+            fields.push_back(f);
+
+            if (i >= n)
+                return -1;
+            if (',' == s[pos_[i]])
+            {
+                ++i;
+                continue;
+            }
+            if (i != n - 1)
+                return -1;
+            break;
+        }
+
+        return (int)fields.size();
+    }
+
+    /**
+      The order of the fields in the DOM object (a std::map): sorted by the key bytes, a repeated
+      key keeping its last value only. 'order' receives the positions of the fields in 'fields'.
+    */
+    static void dom_order(const std::vector<flat_field>& fields, std::vector<uint32_t>& order)
+    {
+        order.resize(fields.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = (uint32_t)i;
+
+        std::stable_sort(order.begin(), order.end(),
+                         [&fields](uint32_t a, uint32_t b) { return fields[a].key < fields[b].key; });
+
+        auto out = order.begin();
+        for (auto it = order.begin(); it != order.end(); ++it)
+        {
+            if (it + 1 != order.end() && fields[*(it + 1)].key == fields[*it].key)
+                continue;
+            *out++ = *it;
+        }
+        order.erase(out, order.end());
+    }
+
+private:
+
+    static bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    static void skip_ws(const char*& p, const char* end)
+    {
+        while (p != end && (' ' == *p || '\t' == *p || '\r' == *p || '\n' == *p))
+            ++p;
+    }
+
+    static bool parse_literal(const char*& p, const char* end, const char* lit, size_t len)
+    {
+        if ((size_t)(end - p) < len || 0 != memcmp(p, lit, len))
+            return false;
+        p += len;
+        return true;
+    }
+
+    // A scalar value, the strings are taken straight from the structural index
+    static bool parse_value(const char*& p, const char* end, flat_field& f)
+    {
+        switch (*p)
+        {
+        case 't':
+            f.kind = flat_value_kind::boolean;
+            f.b = true;
+            return parse_literal(p, end, "true", 4);
+        case 'f':
+            f.kind = flat_value_kind::boolean;
+            f.b = false;
+            return parse_literal(p, end, "false", 5);
+        default:
+            return parse_number(p, end, f);
+        }
+    }
+
+    // The strict JSON number grammar, converted without going through a C string
+    static bool parse_number(const char*& p, const char* end, flat_field& f)
+    {
+        const char* beg = p;
+        bool negative = false;
+        bool floating = false;
+
+        if ('-' == *p)
+        {
+            negative = true;
+            if (++p == end)
+                return false;
+        }
+
+        // The integer part is accumulated on the way, up to 19 digits cannot overflow
+        const char* digits = p;
+        uint64_t val = 0;
+        if ('0' == *p)
+            ++p;
+        else if (is_digit(*p))
+            while (p != end && is_digit(*p))
+                val = val * 10 + (uint64_t)(*p++ - '0');
+        else
+            return false;
+
+        if (p != end && '.' == *p)
+        {
+            floating = true;
+            if (++p == end || !is_digit(*p))
+                return false;
+            while (p != end && is_digit(*p))
+                ++p;
+        }
+
+        if (p != end && ('e' == *p || 'E' == *p))
+        {
+            floating = true;
+            if (++p != end && ('+' == *p || '-' == *p))
+                ++p;
+            if (p == end || !is_digit(*p))
+                return false;
+            while (p != end && is_digit(*p))
+                ++p;
+        }
+
+        if (!floating && p - digits <= 19)
+        {
+            if (!negative)
+            {
+                f.kind = flat_value_kind::unsigned_integer;
+                f.u = val;
+                return true;
+            }
+            if (val <= (uint64_t)INT64_MAX + 1)
+            {
+                f.kind = flat_value_kind::signed_integer;
+                f.i = (int64_t)(0 - val);
+                return true;
+            }
+        }
+
+        std::from_chars_result rv;
+        if (floating)
+        {
+            f.kind = flat_value_kind::floating;
+            rv = std::from_chars(beg, p, f.d);
+        }
+        else if (negative)
+        {
+            f.kind = flat_value_kind::signed_integer;
+            rv = std::from_chars(beg, p, f.i);
+        }
+        else
+        {
+            f.kind = flat_value_kind::unsigned_integer;
+            rv = std::from_chars(beg, p, f.u);
+        }
+
+        // Out of range values are left to the generic parser
+        return std::errc() == rv.ec && rv.ptr == p;
+    }
+
+private:
+    structural_indexer      indexer_;
+    std::vector<uint32_t>   pos_;
+};
+
+#endif // JSON_FLAT_PARSER_HEADER
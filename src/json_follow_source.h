@@ -0,0 +1,196 @@
+#ifndef FOLLOW_SOURCE_HEADER
+#define FOLLOW_SOURCE_HEADER
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <stdexcept>
+#include "json_raw_data_source.h"
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+/**
+  * Reads a file that is still being written, in the manner of 'tail -f'.
+  * At the end of the data it calls the idle callback (to let the consumer flush its output) and
+  * then sleeps on an inotify watch of the file until more data is appended. The trailing partial
+  * line simply stays in the line reader's carry buffer until its line end arrives.
+  * The end of the input is reported only once the file is deleted (its last link removed) or renamed away (and drained),
+  * or once 'request_stop' is called, e.g. from a signal handler.
+*/
+class raw_follow_source : public raw_stream_source
+{
+public:
+    static const int DEFAULT_IDLE_TIMEOUT_MS = 1000;
+
+    raw_follow_source() = default;
+    ~raw_follow_source() override { close(); }
+
+    int open(const string& fname, size_t chunk_size = DEFAULT_CHUNK_SIZE, uint64_t start_offset = 0,
+             std::function<void()> on_idle = nullptr, int idle_timeout_ms = DEFAULT_IDLE_TIMEOUT_MS)
+    {
+        close();
+
+        if (-1 == (fd_ = ::open(fname.c_str(), O_RDONLY)))
+            return -1;
+
+        if (start_offset && (off_t)-1 == lseek(fd_, (off_t)start_offset, SEEK_SET))
+        {
+            close();
+            return -1;
+        }
+
+        if (-1 == (ino_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+            || -1 == inotify_add_watch(ino_fd_, fname.c_str(), IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF))
+        {
+            close();
+            return -1;
+        }
+
+        offset_ = start_offset;
+        on_idle_ = on_idle;
+        idle_timeout_ms_ = idle_timeout_ms;
+        gone_ = false;
+        restarted_ = false;
+        set_chunk_size(chunk_size);
+        return 0;
+    }
+
+    void close()
+    {
+        if (-1 != ino_fd_)
+            ::close(ino_fd_);
+        if (-1 != fd_)
+            ::close(fd_);
+        ino_fd_ = fd_ = -1;
+    }
+
+    // Make every follow source report the end of its input, async-signal-safe
+    static void request_stop()
+    {
+        stop_flag().store(true, std::memory_order_relaxed);
+    }
+
+    size_t read_into(char* buf, size_t size) override
+    {
+        if (-1 == fd_)
+            throw (std::runtime_error("No open input file to read"));
+
+        for (;;)
+        {
+            ssize_t rv = ::read(fd_, buf, size);
+            if (rv > 0)
+            {
+                offset_ += (uint64_t)rv;
+                return (size_t)rv;
+            }
+
+            if (rv < 0)
+            {
+                if (EINTR == errno)
+                    continue;
+                throw (std::runtime_error("Error reading the followed file"));
+            }
+
+            // Caught up with the writer
+            if (gone_ || stop_flag().load(std::memory_order_relaxed))
+                return 0;
+
+            check_truncated();
+
+            if (on_idle_)
+                on_idle_();
+
+            auto t0 = std::chrono::steady_clock::now();
+            wait_for_change();
+            stats_.wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        }
+    }
+
+    const char* name() const override
+    {
+        return "follow";
+    }
+
+    bool take_restart(uint64_t& offset) override
+    {
+        if (!restarted_)
+            return false;
+        restarted_ = false;
+        offset = 0;
+        return true;
+    }
+
+private:
+
+    static std::atomic<bool>& stop_flag()
+    {
+        static std::atomic<bool> flag{false};
+        return flag;
+    }
+
+    // A file truncated in place (copytruncate rotation) is read again from its beginning
+    void check_truncated()
+    {
+        struct stat st;
+        if (0 == fstat(fd_, &st) && (uint64_t)st.st_size < offset_)
+        {
+            lseek(fd_, 0, SEEK_SET);
+            offset_ = 0;
+            restarted_ = true;
+        }
+    }
+
+    bool is_unlinked() const
+    {
+        struct stat st;
+        return 0 == fstat(fd_, &st) && 0 == st.st_nlink;
+    }
+
+    void wait_for_change()
+    {
+        pollfd pfd = { ino_fd_, POLLIN, 0 };
+        int rv = poll(&pfd, 1, idle_timeout_ms_);
+        if (rv <= 0)
+            return;
+
+        alignas(inotify_event) char evbuf[4096];
+        ssize_t len;
+        while ((len = ::read(ino_fd_, evbuf, sizeof(evbuf))) > 0)
+        {
+            for (char* p = evbuf; p < evbuf + len; )
+            {
+                const inotify_event* ev = (const inotify_event*)p;
+                // Rotated away: drain what is left of it, then finish
+                if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
+                    gone_ = true;
+                // IN_DELETE_SELF waits for the last descriptor to close, so an unlink shows up only as
+                // a link count change on the file we still hold open
+                else if ((ev->mask & IN_ATTRIB) && is_unlinked())
+                    gone_ = true;
+                p += sizeof(inotify_event) + ev->len;
+            }
+        }
+    }
+
+private:
+    int                     fd_{-1};
+    int                     ino_fd_{-1};
+    uint64_t                offset_{0};
+    bool                    gone_{false};
+    bool                    restarted_{false};  // Truncated and read again from the beginning, see 'take_restart'
+    std::function<void()>   on_idle_;
+    int                     idle_timeout_ms_{DEFAULT_IDLE_TIMEOUT_MS};
+};
+
+#endif // __linux__
+
+#endif // FOLLOW_SOURCE_HEADER
@@ -0,0 +1,297 @@
+#ifndef JSON_KEY_DICTIONARY_HEADER
+#define JSON_KEY_DICTIONARY_HEADER
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "json_simd.h"
+#include "json_common.h"
+
+/**
+  * CRC32C (Castagnoli) of the key bytes, the hash of the key dictionary. On x86 the SSE4.2 crc32
+  * instruction is used when the running CPU has it, elsewhere a lookup table gives the same values.
+*/
+
+struct crc32c_table
+{
+    uint32_t t[256];
+
+    constexpr crc32c_table()
+        : t()
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+            t[i] = c;
+        }
+    }
+};
+
+inline uint32_t crc32c_scalar(const char* p, size_t len)
+{
+    static constexpr crc32c_table table;
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; ++i)
+        crc = table.t[(crc ^ (unsigned char)p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+#if defined(JSON_SIMD_X86)
+
+__attribute__((target("sse4.2")))
+inline uint32_t crc32c_sse42(const char* p, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+    size_t i = 0;
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        crc64 = _mm_crc32_u64(crc64, w);
+    }
+    crc = (uint32_t)crc64;
+#endif
+    for (; i + 4 <= len; i += 4)
+    {
+        uint32_t w;
+        memcpy(&w, p + i, sizeof(w));
+        crc = _mm_crc32_u32(crc, w);
+    }
+    for (; i < len; ++i)
+        crc = _mm_crc32_u8(crc, (unsigned char)p[i]);
+    return ~crc;
+}
+
+#endif // JSON_SIMD_X86
+
+using crc32c_fn = uint32_t (*)(const char*, size_t);
+
+inline crc32c_fn select_crc32c()
+{
+#if defined(JSON_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2"))
+        return crc32c_sse42;
+#endif
+    return crc32c_scalar;
+}
+
+inline uint32_t crc32c(std::string_view s)
+{
+    static const crc32c_fn hash = select_crc32c();
+    return hash(s.data(), s.size());
+}
+
+/**
+  * The dictionary of the record keys: a flat open-addressing table with Robin Hood probing, looked
+  * up by string_view so that no string is built per field.
+  * The key bytes are interned back to back in an arena, the slots only hold their offsets and
+  * sizes along with the hash and the ID. A lookup is a single probe sequence, which also finds the
+  * slot of a missing key: as the probe distances of the slots met never exceed the one of a present
+  * key, the first slot with a shorter distance ends the search. The table doubles at 7/8 full.
+  * Keys are only ever removed by 'erase_if', which rebuilds the table and the arena.
+*/
+class key_dictionary
+{
+public:
+    using string_view = std::string_view;
+    using entry = std::pair<string_view, dictionary_value_type>;
+
+    static constexpr size_t INITIAL_CAPACITY = 64;
+
+    key_dictionary() = default;
+
+    size_t size() const     { return count_; }
+    bool empty() const      { return 0 == count_; }
+
+    void clear()
+    {
+        slots_.clear();
+        arena_.clear();
+        count_ = 0;
+    }
+
+    /**
+      The ID of 'key' and false if it is present, else 'value' and true once it has been added,
+      in one lookup.
+    */
+    std::pair<dictionary_value_type, bool> try_emplace(string_view key, dictionary_value_type value)
+    {
+        uint32_t hash = hash_of(key);
+        size_t pos;
+        if (find_slot(key, hash, pos))
+            return { slots_[pos].value, false };
+
+        if ((count_ + 1) * 8 > slots_.size() * 7)
+        {
+            grow();
+            find_slot(key, hash, pos);
+        }
+
+        slot s;
+        s.hash = hash;
+        s.offset = (uint32_t)arena_.size();
+        s.size = (uint32_t)key.size();
+        s.value = value;
+        arena_.append(key.data(), key.size());
+        place(s, pos);
+        ++count_;
+        return { value, true };
+    }
+
+    // Set the ID of 'key', adding the key if it is new
+    void assign(string_view key, dictionary_value_type value)
+    {
+        uint32_t hash = hash_of(key);
+        size_t pos;
+        if (find_slot(key, hash, pos))
+            slots_[pos].value = value;
+        else
+            try_emplace(key, value);
+    }
+
+    // Returns false if the key is not present
+    bool find(string_view key, dictionary_value_type& value) const
+    {
+        size_t pos;
+        if (!find_slot(key, hash_of(key), pos))
+            return false;
+        value = slots_[pos].value;
+        return true;
+    }
+
+    // The keys with their IDs, sorted by the key bytes as the std::map of the dictionary had them
+    std::vector<entry> sorted_entries() const
+    {
+        std::vector<entry> entries;
+        entries.reserve(count_);
+        for (const slot& s : slots_)
+            if (s.hash)
+                entries.emplace_back(key_of(s), s.value);
+        std::sort(entries.begin(), entries.end(), [](const entry& a, const entry& b) { return a.first < b.first; });
+        return entries;
+    }
+
+    // Remove the keys for which 'pred(key, value)' holds
+    template <typename Pred>
+    void erase_if(Pred pred)
+    {
+        key_dictionary kept;
+        kept.reserve(count_);
+        for (const slot& s : slots_)
+            if (s.hash && !pred(key_of(s), s.value))
+                kept.try_emplace(key_of(s), s.value);
+        *this = std::move(kept);
+    }
+
+    void reserve(size_t count)
+    {
+        size_t capacity = slots_.empty() ? INITIAL_CAPACITY : slots_.size();
+        while (count * 8 > capacity * 7)
+            capacity *= 2;
+        if (capacity != slots_.size())
+            rehash(capacity);
+    }
+
+private:
+
+    // An empty slot has a zero hash
+    struct slot
+    {
+        uint32_t                hash{0};
+        uint32_t                offset{0};
+        uint32_t                size{0};
+        dictionary_value_type   value{0};
+    };
+
+    static uint32_t hash_of(string_view key)
+    {
+        uint32_t h = crc32c(key);
+        return h ? h : 1;
+    }
+
+    string_view key_of(const slot& s) const
+    {
+        return string_view(arena_.data() + s.offset, s.size);
+    }
+
+    size_t distance(const slot& s, size_t pos) const
+    {
+        return (pos - (s.hash & (slots_.size() - 1))) & (slots_.size() - 1);
+    }
+
+    /**
+      Probe for 'key': true with its slot in 'pos' if present, else false with the slot a new
+      key goes to in 'pos' (empty or to be taken over from a closer one).
+    */
+    bool find_slot(string_view key, uint32_t hash, size_t& pos) const
+    {
+        if (slots_.empty())
+        {
+            pos = 0;
+            return false;
+        }
+
+        const size_t mask = slots_.size() - 1;
+        pos = hash & mask;
+        for (size_t dist = 0; ; ++dist, pos = (pos + 1) & mask)
+        {
+            const slot& s = slots_[pos];
+            if (!s.hash || distance(s, pos) < dist)
+                return false;
+            if (s.hash == hash && s.size == key.size() && 0 == memcmp(arena_.data() + s.offset, key.data(), key.size()))
+                return true;
+        }
+    }
+
+    // Put 's' at 'pos', shifting the richer slots from there on down the probe sequence
+    void place(slot s, size_t pos)
+    {
+        const size_t mask = slots_.size() - 1;
+        size_t dist = distance(s, pos);
+        for (;; pos = (pos + 1) & mask, ++dist)
+        {
+            slot& cur = slots_[pos];
+            if (!cur.hash)
+            {
+                cur = s;
+                return;
+            }
+            size_t cur_dist = distance(cur, pos);
+            if (cur_dist < dist)
+            {
+                std::swap(cur, s);
+                dist = cur_dist;
+            }
+        }
+    }
+
+    void grow()
+    {
+        rehash(slots_.empty() ? INITIAL_CAPACITY : slots_.size() * 2);
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<slot> old(capacity);
+        old.swap(slots_);
+        for (const slot& s : old)
+            if (s.hash)
+                place(s, s.hash & (capacity - 1));
+    }
+
+private:
+    std::vector<slot>   slots_;
+    std::string         arena_;
+    size_t              count_{0};
+};
+
+#endif // JSON_KEY_DICTIONARY_HEADER
@@ -0,0 +1,273 @@
+#ifndef MULTI_FILE_READER_HEADER
+#define MULTI_FILE_READER_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "json_raw_data_reader.h"
+#include "json_spsc_queue.h"
+
+/**
+  Read a manifest: one input file name per line, the empty lines and the lines starting with '#'
+  are skipped. Returns -1 if the manifest cannot be read.
+*/
+inline int read_manifest(const std::string& fname, std::vector<std::string>& files)
+{
+    raw_data_file_reader rdr;
+    if (-1 == rdr.open(fname))
+        return -1;
+
+    std::string line;
+    while (-1 != rdr.read(line))
+    {
+        size_t beg = line.find_first_not_of(" \t");
+        size_t end = line.find_last_not_of(" \t");
+        if (std::string::npos == beg || '#' == line[beg])
+            continue;
+        files.push_back(line.substr(beg, end - beg + 1));
+    }
+    return 0;
+}
+
+/**
+  * Reads a list of input files concurrently through a pool of reader threads.
+  * Every worker takes the next unread file, splits it into lines and ships them in large batches
+  * through a per-file single producer / single consumer queue. The lines are handed out to the
+  * caller file by file, in the order of the list, so the output does not depend on the timing;
+  * the workers meanwhile read the following files ahead, bounded by the queue depth.
+*/
+class raw_multi_file_reader
+{
+public:
+    using string = std::string;
+    using string_view = std::string_view;
+
+    static const int DEFAULT_JOBS = 4;
+    static const size_t BATCH_BYTES = 1 << 20;
+    static const size_t BATCHES_AHEAD = 8;
+
+    raw_multi_file_reader() = default;
+    ~raw_multi_file_reader() { close(); }
+
+    raw_multi_file_reader(const raw_multi_file_reader&) = delete;
+    raw_multi_file_reader& operator=(const raw_multi_file_reader&) = delete;
+
+    int open(const std::vector<string>& files, const raw_reader_options& opts = raw_reader_options(), int jobs = DEFAULT_JOBS)
+    {
+        close();
+
+        if (files.empty())
+            return -1;
+
+        files_ = files;
+        opts_ = opts;
+        stop_.store(false);
+        next_file_.store(0);
+        current_ = 0;
+        failed_files_ = 0;
+
+        queues_.clear();
+        for (size_t i = 0; i < files_.size(); ++i)
+            queues_.emplace_back(new spsc_queue<line_batch*>(BATCHES_AHEAD));
+
+        if (jobs < 1)
+            jobs = 1;
+        if (jobs > (int)files_.size())
+            jobs = (int)files_.size();
+        for (int i = 0; i < jobs; ++i)
+            workers_.emplace_back(&raw_multi_file_reader::read_files, this);
+        return 0;
+    }
+
+    void close()
+    {
+        stop_.store(true, std::memory_order_release);
+        for (auto& w : workers_)
+            w.join();
+        workers_.clear();
+
+        // Drop whatever was read but not consumed
+        line_batch* batch;
+        for (auto& q : queues_)
+            while (q->pop(batch))
+                delete batch;
+        queues_.clear();
+        batch_.reset();
+    }
+
+    /**
+      Read the next line of the inputs into 'data', the index of its file goes to 'file_index'.
+      The view stays valid until the next read. Returns the length of the line or -1 after the last
+      line of the last file.
+    */
+    int read(string_view& data, int& file_index)
+    {
+        for (;;)
+        {
+            if (batch_ && line_ < batch_->ends.size())
+            {
+                uint32_t beg = line_ ? batch_->ends[line_ - 1] : 0;
+                uint32_t end = batch_->ends[line_++];
+                data = string_view(batch_->data.data() + beg, end - beg);
+                file_index = (int)current_;
+                return (int)data.size();
+            }
+
+            if (batch_ && batch_->last)
+                ++current_;
+
+            batch_.reset();
+            if (current_ >= files_.size())
+                return -1;
+
+            line_batch* batch;
+            if (!queues_[current_]->pop(batch))
+            {
+                auto t0 = std::chrono::steady_clock::now();
+                while (!queues_[current_]->pop(batch))
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                stats_.wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            }
+
+            batch_.reset(batch);
+            line_ = 0;
+
+            if (batch->failed)
+                printf("Failed to open the input file: '%s'\n", files_[current_].c_str());
+            if (batch->failed || batch->broken)
+                ++failed_files_;
+        }
+    }
+
+    // Input file offset of the line returned by the last read, in its own file
+    uint64_t line_offset() const
+    {
+        return batch_ && line_ ? batch_->offsets[line_ - 1] : 0;
+    }
+
+    const std::vector<string>& files() const
+    {
+        return files_;
+    }
+
+    // Number of the input files read so far that could not be opened or stopped on a read error
+    size_t failed_files() const
+    {
+        return failed_files_;
+    }
+
+    raw_input_stats stats() const
+    {
+        raw_input_stats st = stats_;
+        st.bytes = bytes_.load();
+        st.chunks = chunks_.load();
+        return st;
+    }
+
+    const char* backend_name() const
+    {
+        return "multi-file";
+    }
+
+private:
+
+    struct line_batch
+    {
+        string                  data;           // The lines back to back, without their line ends
+        std::vector<uint32_t>   ends;           // End offset of each line in 'data'
+        std::vector<uint64_t>   offsets;        // Input file offset of each line
+        bool                    last{false};    // The last batch of its file
+        bool                    failed{false};  // The file could not be opened
+        bool                    broken{false};  // Reading the file stopped on an error
+    };
+
+    // Worker thread
+    void read_files()
+    {
+        for (;;)
+        {
+            size_t idx = next_file_.fetch_add(1);
+            if (idx >= files_.size())
+                return;
+
+            raw_data_file_reader rdr;
+            std::unique_ptr<line_batch> batch(new line_batch);
+
+            try
+            {
+                if (-1 == rdr.open(files_[idx], opts_))
+                    batch->failed = true;
+                else
+                {
+                    string_view line;
+                    while (-1 != rdr.read(line))
+                    {
+                        batch->data.append(line.data(), line.size());
+                        batch->ends.push_back((uint32_t)batch->data.size());
+                        batch->offsets.push_back(rdr.line_offset());
+                        if (batch->data.size() >= BATCH_BYTES)
+                        {
+                            if (!ship(idx, batch.release()))
+                                return;
+                            batch.reset(new line_batch);
+                        }
+                    }
+
+                    raw_input_stats st = rdr.stats();
+                    bytes_ += st.bytes;
+                    chunks_ += st.chunks;
+                }
+            }
+            catch (const std::exception& e)
+            {
+                printf("Exception reading '%s': %s\n", files_[idx].c_str(), e.what());
+                batch->broken = true;
+            }
+
+            batch->last = true;
+            if (!ship(idx, batch.release()))
+                return;
+        }
+    }
+
+    // Queue a batch for the consumer, waiting while it is behind. Fails only when shutting down.
+    bool ship(size_t idx, line_batch* batch)
+    {
+        while (!queues_[idx]->push(batch))
+        {
+            if (stop_.load(std::memory_order_acquire))
+            {
+                delete batch;
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        return true;
+    }
+
+private:
+    std::vector<string>                                    files_;
+    raw_reader_options                                     opts_;
+    std::vector<std::unique_ptr<spsc_queue<line_batch*>>> queues_;
+    std::vector<std::thread>                               workers_;
+    std::atomic<size_t>                                    next_file_{0};
+    std::atomic<bool>                                      stop_{false};
+
+    std::atomic<uint64_t>                                  bytes_{0};
+    std::atomic<uint64_t>                                  chunks_{0};
+    raw_input_stats                                        stats_;
+
+    // Consumer side state
+    size_t                                                 current_{0};
+    std::unique_ptr<line_batch>                            batch_;
+    size_t                                                 line_{0};
+    size_t                                                 failed_files_{0};
+};
+
+#endif // MULTI_FILE_READER_HEADER
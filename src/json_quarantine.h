@@ -0,0 +1,146 @@
+#ifndef JSON_QUARANTINE_HEADER
+#define JSON_QUARANTINE_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/**
+  * Reasons for rejecting an input record, as the processing reports them instead of throwing.
+*/
+enum class record_error
+{
+    none,
+    malformed,          // Not valid JSON
+    not_an_object,      // A valid JSON value other than an object
+    nested_value,       // An object or an array as the value of a field
+    null_value,         // A null as the value of a field
+    invalid_utf8,       // Not valid UTF-8, checked ahead of the parsing
+
+    count               // Number of the reasons, not a reason
+};
+
+inline const char* record_error_name(record_error err)
+{
+    static const char* const names[] = { "none", "malformed", "not an object", "nested value", "null value", "invalid UTF-8" };
+    static_assert(sizeof(names) / sizeof(names[0]) == (size_t)record_error::count, "a name per reason");
+    return names[(size_t)err];
+}
+
+/**
+  * The rejected records of a run: counted by their reason and, if a quarantine file is given,
+  * written there to be looked at or replayed later. The file has a line per record, its fields
+  * separated by tabs: the input file, the input offset of the record, the reason and the record
+  * itself as it was read.
+*/
+class record_quarantine
+{
+public:
+    using string = std::string;
+    using string_view = std::string_view;
+
+    record_quarantine() = default;
+    record_quarantine(const record_quarantine&) = delete;
+    record_quarantine& operator=(const record_quarantine&) = delete;
+    ~record_quarantine() { close(); }
+
+    // Open the quarantine file, truncating it unless 'append'
+    int open(const string& fname, bool append = false)
+    {
+        close();
+        if (!(pf_ = fopen(fname.c_str(), append ? "ab" : "wb")))
+            return -1;
+        // Where the appending starts, 'tell' must see it before the first write
+        if (append)
+            fseek(pf_, 0, SEEK_END);
+        name_ = fname;
+        return 0;
+    }
+
+    void close()
+    {
+        if (pf_)
+            fclose(pf_);
+        pf_ = nullptr;
+    }
+
+    void add(string_view input, uint64_t offset, record_error err, string_view line)
+    {
+        ++counts_[(size_t)err];
+        ++total_;
+        if (!pf_)
+            return;
+        fprintf(pf_, "%.*s\t%llu\t%s\t", (int)input.size(), input.data(), (unsigned long long)offset, record_error_name(err));
+        // The record bytes as they are, '%.*s' would stop at an embedded NUL
+        fwrite(line.data(), 1, line.size(), pf_);
+        fputc('\n', pf_);
+    }
+
+    // Push the records written so far to the disk, before a checkpoint refers to them
+    void sync()
+    {
+        if (!pf_)
+            return;
+        fflush(pf_);
+#if defined(_WIN32)
+        _commit(_fileno(pf_));
+#else
+        fsync(fileno(pf_));
+#endif
+    }
+
+    // Size of the file, counting the records not flushed yet
+    uint64_t tell()
+    {
+        if (!pf_)
+            return 0;
+#if defined(_WIN32)
+        return (uint64_t)_ftelli64(pf_);
+#else
+        return (uint64_t)ftello(pf_);
+#endif
+    }
+
+    // Cut the file back to 'offset', dropping the records added after it was told, e.g. when resuming a run
+    int truncate_at(uint64_t offset)
+    {
+        if (!pf_)
+            return 0;
+        fflush(pf_);
+        // The stream position does not follow the cut by itself, 'tell' would report the old size
+#if defined(_WIN32)
+        if (_chsize_s(_fileno(pf_), (long long)offset) || _fseeki64(pf_, (long long)offset, SEEK_SET))
+            return -1;
+#else
+        if (ftruncate(fileno(pf_), (off_t)offset) || fseeko(pf_, (off_t)offset, SEEK_SET))
+            return -1;
+#endif
+        return tell() == offset ? 0 : -1;
+    }
+
+    // Push the records written so far to the file
+    void flush()
+    {
+        if (pf_)
+            fflush(pf_);
+    }
+
+    uint64_t count(record_error err) const  { return counts_[(size_t)err]; }
+    uint64_t total() const                  { return total_; }
+    bool is_open() const                    { return nullptr != pf_; }
+    const string& name() const              { return name_; }
+
+private:
+    FILE*       pf_{nullptr};
+    string      name_;
+    uint64_t    counts_[(size_t)record_error::count]{};
+    uint64_t    total_{0};
+};
+
+#endif // JSON_QUARANTINE_HEADER
@@ -2,55 +2,394 @@
 #define RAW_DATA_FILE_READER_HEADER
 
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <string>
+#include <string_view>
 #include <memory>
+#include <functional>
+#include <stdexcept>
+#include "json_raw_data_source.h"
+#include "json_read_ahead_source.h"
+#include "json_uring_source.h"
+#include "json_decompress_source.h"
+#include "json_follow_source.h"
+#include "json_simd.h"
+
+/**
+  * The ways the input file can be read.
+  *   buffered - the file is read in large chunks with read(2) and split into lines in place
+  *   mmap     - the whole file is mapped into memory and lines are handed out as views into the
+  *              mapping, so no line bytes are copied. Falls back to 'buffered' where mmap is not available.
+  *   uring    - several large reads are kept in flight with io_uring. Falls back to 'buffered' where
+  *              io_uring is not available.
+  *   direct   - the file is read with O_DIRECT around the page cache, always with a read-ahead stage.
+  *              Falls back to 'buffered' where the file system does not support it.
+*/
+enum class raw_read_mode
+{
+    buffered,
+    mmap,
+    uring,
+    direct
+};
+
+/**
+  * Input stage configuration.
+*/
+struct raw_reader_options
+{
+    raw_read_mode   mode{raw_read_mode::buffered};
+    size_t          chunk_size{raw_stream_source::DEFAULT_CHUNK_SIZE};
+
+    // Number of buffers filled ahead by a background I/O thread, 0 reads on the caller's thread.
+    // In the 'uring' mode it is the number of reads kept in flight instead.
+    int             read_ahead_buffers{0};
+
+    // Byte range of the input to process, [range_begin, range_end). A line belongs to the range its
+    // first byte falls into, so the line crossing 'range_begin' is skipped and the one crossing
+    // 'range_end' is read to its end. Adjacent ranges thus split the input without gaps or overlaps.
+    uint64_t        range_begin{0};
+    uint64_t        range_end{UINT64_MAX};
+
+    // Keep reading a file that is still being written, see raw_follow_source. The idle callback
+    // is invoked on the reader's thread whenever it has caught up with the writer.
+    bool                    follow{false};
+    std::function<void()>   on_idle;
+};
 
 /**
   * This is a simple class for reading data streams of json formatted strings per each line.
+  * The lines are found with a vectorized newline scan over the chunks handed out by the
+  * underlying data source, records of any length are supported.
 */
 class raw_data_file_reader
 {
 public:
-    
+
     using string = std::string;
+    using string_view = std::string_view;
+
     raw_data_file_reader() = default;
     ~raw_data_file_reader() { }
 
-    int open(const string& fname) 
+    raw_data_file_reader(const raw_data_file_reader&) = delete;
+    raw_data_file_reader& operator=(const raw_data_file_reader&) = delete;
+
+    int open(const string& fname, const raw_reader_options& opts = raw_reader_options())
     {
-        pf_.reset(fopen(fname.c_str(), "rb"), fclose);
-        if (!pf_.get())
+        close();
+
+        // Start one byte early, so that a line beginning right at 'range_begin' is recognized by
+        // the line end in front of it
+        uint64_t start = opts.range_begin > 0 ? opts.range_begin - 1 : 0;
+        if (-1 == open_source(fname, opts, start))
             return -1;
+
+        chunk_offset_ = start;
+        range_end_ = opts.range_end;
+        skip_partial_ = opts.range_begin > 0;
         return 0;
     }
-    
-    int read(string& data)
+
+    /**
+      Whether the input can be opened at an arbitrary byte offset, i.e. given a byte range or resumed
+      from a checkpoint. Pipes cannot be sought in and the offsets of a compressed stream are those
+      of its decompressed data.
+    */
+    static bool supports_offsets(const string& fname)
+    {
+#if !defined(_WIN32)
+        if (raw_pipe_source::is_pipe(fname))
+            return false;
+#endif
+        return raw_compression::none == detect_compression(fname);
+    }
+
+    raw_input_stats stats() const
+    {
+        return src_ ? src_->stats() : raw_input_stats();
+    }
+
+    const char* backend_name() const
+    {
+        return src_ ? src_->name() : "none";
+    }
+
+    void close()
+    {
+        src_.reset();
+        chunk_ = string_view();
+        pos_ = 0;
+        carry_.clear();
+        carry_out_ = false;
+        chunk_offset_ = 0;
+        carry_offset_ = 0;
+        line_offset_ = 0;
+        range_end_ = UINT64_MAX;
+        skip_partial_ = false;
+        range_done_ = false;
+    }
+
+    /**
+      Read the next line, stripped of its trailing Lf/CrLf, into 'data'.
+      The view points either into the current chunk of the source or, for the lines spanning two
+      chunks, into an internal buffer. Either way it stays valid until the next read.
+      Returns the length of the line or -1 at the end of the input (or of the byte range).
+    */
+    int read(string_view& data)
     {
-        if (!pf_)
+        if (!src_)
             throw (std::runtime_error("No open input file to read"));
-        
-        data.clear();
-        static const int READ_BUF_SIZE = 1024;
-        char buf[READ_BUF_SIZE];
-        char* prv = fgets(buf, READ_BUF_SIZE, pf_.get());
-        
-        if (!prv)
+
+        if (range_done_)
+            return -1;
+
+        if (skip_partial_)
+        {
+            // The line crossing the beginning of the range belongs to the previous range
+            skip_partial_ = false;
+            if (-1 == read_line(data))
+                return -1;
+        }
+
+        int rv = read_line(data);
+        if (-1 != rv && line_offset_ >= range_end_)
+        {
+            range_done_ = true;
+            return -1;
+        }
+        return rv;
+    }
+
+    int read(string& data)
+    {
+        string_view sv;
+        int rv = read(sv);
+        if (-1 == rv)
+            data.clear();
+        else
+            data.assign(sv.data(), sv.size());
+        return rv;
+    }
+
+    // Input file offset of the first byte of the line returned by the last read
+    uint64_t line_offset() const
+    {
+        return line_offset_;
+    }
+
+    // Input file offset right past the line returned by the last read, including its line end
+    uint64_t next_offset() const
+    {
+        return chunk_offset_ + pos_;
+    }
+
+private:
+
+    int open_source(const string& fname, const raw_reader_options& opts, uint64_t start)
+    {
+#if !defined(_WIN32)
+        // Checked first, peeking at the magic bytes would consume the data of a pipe
+        if (raw_pipe_source::is_pipe(fname))
+        {
+            if (start)
+            {
+                printf("Byte ranges are not supported for the piped input\n");
+                return -1;
+            }
+
+            std::unique_ptr<raw_pipe_source> src(new raw_pipe_source);
+            if (-1 == src->open(fname, opts.chunk_size))
+                return -1;
+
+            if (opts.read_ahead_buffers > 0)
+                src_.reset(new raw_read_ahead_source(std::move(src), opts.read_ahead_buffers));
+            else
+                src_ = std::move(src);
+            return 0;
+        }
+#endif
+
+#if defined(__linux__)
+        if (opts.follow)
+        {
+            // Read on the caller's thread, the idle callback must run there
+            std::unique_ptr<raw_follow_source> src(new raw_follow_source);
+            if (-1 == src->open(fname, opts.chunk_size, start, opts.on_idle))
+                return -1;
+            src_ = std::move(src);
+            return 0;
+        }
+#endif
+
+        raw_compression comp = detect_compression(fname);
+        if (comp != raw_compression::none)
+        {
+            // The offsets of a compressed stream cannot be sought to
+            if (start)
+            {
+                printf("Byte ranges are not supported for the %s compressed input\n", compression_name(comp));
+                return -1;
+            }
+
+            if (!compression_supported(comp))
+            {
+                printf("This build has no support for the %s compressed input\n", compression_name(comp));
+                return -1;
+            }
+
+            std::unique_ptr<raw_decompress_source> src(new raw_decompress_source);
+            if (-1 == src->open(fname, comp, opts.chunk_size))
+            {
+                printf("Failed to set up the %s decompression of the input\n", compression_name(comp));
+                return -1;
+            }
+
+            // Always inflate on the read-ahead thread, overlapping the decompression with the parsing
+            int buffers = opts.read_ahead_buffers > 0 ? opts.read_ahead_buffers : raw_read_ahead_source::DEFAULT_BUFFER_COUNT;
+            src_.reset(new raw_read_ahead_source(std::move(src), buffers));
+            return 0;
+        }
+
+#if !defined(_WIN32)
+        if (opts.mode == raw_read_mode::mmap)
+        {
+            std::unique_ptr<raw_mapped_source> src(new raw_mapped_source);
+            if (-1 == src->open(fname, start))
+                return -1;
+            src_ = std::move(src);
+            return 0;
+        }
+#endif
+#if defined(JSON_HAVE_IO_URING)
+        if (opts.mode == raw_read_mode::uring)
+        {
+            std::unique_ptr<raw_uring_source> src(new raw_uring_source);
+            int depth = opts.read_ahead_buffers > 0 ? opts.read_ahead_buffers : raw_uring_source::DEFAULT_QUEUE_DEPTH;
+            if (0 == src->open(fname, opts.chunk_size, depth, start))
+            {
+                src_ = std::move(src);
+                return 0;
+            }
+            // No io_uring here (old kernel, seccomp, ...), use the plain reads
+        }
+#endif
+#if !defined(_WIN32) && defined(O_DIRECT)
+        if (opts.mode == raw_read_mode::direct)
+        {
+            std::unique_ptr<raw_direct_source> src(new raw_direct_source);
+            if (0 == src->open(fname, opts.chunk_size, start))
+            {
+                // Without the page cache there is no kernel read-ahead either, always read ahead ourselves
+                int buffers = opts.read_ahead_buffers > 0 ? opts.read_ahead_buffers : raw_read_ahead_source::DEFAULT_BUFFER_COUNT;
+                src_.reset(new raw_read_ahead_source(std::move(src), buffers));
+                return 0;
+            }
+            // No O_DIRECT on this file system (tmpfs, ...), use the plain reads
+        }
+#endif
+        std::unique_ptr<raw_file_source> src(new raw_file_source);
+        if (-1 == src->open(fname, opts.chunk_size, start))
             return -1;
-        
-        data = buf;
-        int k = data.size() - 1;
-        while (k >= 0 && (data[k] == '\n' || data[k] == '\r'))
+
+        if (opts.read_ahead_buffers > 0 && opts.mode != raw_read_mode::uring)
+            src_.reset(new raw_read_ahead_source(std::move(src), opts.read_ahead_buffers));
+        else
+            src_ = std::move(src);
+        return 0;
+    }
+
+    int read_line(string_view& data)
+    {
+        if (carry_out_)
+        {
+            carry_.clear();
+            carry_out_ = false;
+        }
+
+        for (;;)
         {
-            data[k] = 0;
-            --k;
+            const char* pbeg = chunk_.data() + pos_;
+            const char* pend = chunk_.data() + chunk_.size();
+            const char* pnl = pos_ < chunk_.size() ? simd_find_newline(pbeg, pend) : nullptr;
+
+            if (pnl)
+            {
+                if (carry_.empty())
+                {
+                    line_offset_ = chunk_offset_ + pos_;
+                    pos_ += (size_t)(pnl - pbeg) + 1;
+                    return trimmed(string_view(pbeg, (size_t)(pnl - pbeg)), data);
+                }
+
+                pos_ += (size_t)(pnl - pbeg) + 1;
+                carry_.append(pbeg, (size_t)(pnl - pbeg));
+                carry_out_ = true;
+                line_offset_ = carry_offset_;
+                return trimmed(string_view(carry_), data);
+            }
+
+            // No line end in what is left of this chunk, keep the partial line and fetch more
+            if (carry_.empty())
+                carry_offset_ = chunk_offset_ + pos_;
+            carry_.append(pbeg, (size_t)(pend - pbeg));
+            chunk_offset_ += chunk_.size();
+            pos_ = 0;
+            chunk_ = string_view();
+
+            string_view chunk;
+            if (-1 == src_->next_chunk(chunk))
+            {
+                // The last line may be missing its line end
+                if (carry_.empty())
+                    return -1;
+                carry_out_ = true;
+                line_offset_ = carry_offset_;
+                return trimmed(string_view(carry_), data);
+            }
+            chunk_ = chunk;
+
+            // The input started over: the partial line belonged to the old contents
+            uint64_t restart_offset;
+            if (src_->take_restart(restart_offset))
+            {
+                carry_.clear();
+                chunk_offset_ = restart_offset;
+            }
         }
+    }
 
-        data.resize(k + 1);
-        return (int) data.size();
+    static int trimmed(string_view line, string_view& data)
+    {
+        size_t len = line.size();
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            --len;
+
+        data = line.substr(0, len);
+        return (int) len;
     }
 
 private:
-    std::shared_ptr<FILE> pf_;
+    std::unique_ptr<raw_data_source> src_;
+
+    // The chunk being split into lines and the position of the next line in it
+    string_view chunk_;
+    size_t      pos_{0};
+
+    // The beginning of a line that spans chunk boundaries
+    string      carry_;
+    bool        carry_out_{false};
+
+    // Input file offsets of the current chunk, of the carried line and of the last line read
+    uint64_t    chunk_offset_{0};
+    uint64_t    carry_offset_{0};
+    uint64_t    line_offset_{0};
+
+    // Byte range state
+    uint64_t    range_end_{UINT64_MAX};
+    bool        skip_partial_{false};
+    bool        range_done_{false};
 };
 
 #endif // RAW_DATA_FILE_READER_HEADER
@@ -0,0 +1,571 @@
+#ifndef RAW_DATA_SOURCE_HEADER
+#define RAW_DATA_SOURCE_HEADER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <stdexcept>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/**
+  * Counters of the input stage, reported at the end of the processing.
+*/
+struct raw_input_stats
+{
+    uint64_t bytes{0};          // Bytes handed out to the reader
+    uint64_t chunks{0};         // Chunks handed out to the reader
+    double   wait_seconds{0};   // Time the reader spent blocked waiting for the data
+};
+
+/**
+  * Source of the raw input bytes for the line reader.
+  * A source hands out the input as a sequence of chunks, each of which stays valid until the next
+  * call to 'next_chunk'. Lines may span chunk boundaries, stitching them back is up to the reader.
+*/
+class raw_data_source
+{
+public:
+    using string = std::string;
+    using string_view = std::string_view;
+
+    virtual ~raw_data_source() = default;
+
+    /**
+      Get the next chunk of the input.
+      Returns the size of the chunk or -1 at the end of the input. Throws on read errors.
+    */
+    virtual int64_t next_chunk(string_view& chunk) = 0;
+
+    // Short name of the input backend, for the reports
+    virtual const char* name() const = 0;
+
+    /**
+      Whether the input started over at 'offset' since the previous chunk, e.g. a followed file
+      truncated in place: the last chunk handed out does not continue into the next one. The
+      notice is given once.
+    */
+    virtual bool take_restart(uint64_t& offset)
+    {
+        return false;
+    }
+
+    const raw_input_stats& stats() const
+    {
+        return stats_;
+    }
+
+protected:
+
+    void count_chunk(size_t size)
+    {
+        stats_.bytes += size;
+        ++stats_.chunks;
+    }
+
+protected:
+    raw_input_stats stats_;
+};
+
+/**
+  * Source that copies the input into buffers provided by the caller. Its chunks are read into
+  * a single reusable buffer, while 'read_into' lets a read-ahead stage fill buffers of its own.
+*/
+class raw_stream_source : public raw_data_source
+{
+public:
+    static const size_t DEFAULT_CHUNK_SIZE = 4 << 20;
+
+    // The chunk buffers start on a page boundary, as required by the unbuffered (O_DIRECT) reads
+    static const size_t BUFFER_ALIGNMENT = 4096;
+
+    // Allocate a buffer of 'size' bytes, the aligned start of which goes to 'aligned'
+    static std::unique_ptr<char[]> alloc_aligned(size_t size, char*& aligned)
+    {
+        std::unique_ptr<char[]> mem(new char[size + BUFFER_ALIGNMENT]);
+        aligned = (char*)(((uintptr_t)mem.get() + BUFFER_ALIGNMENT - 1) & ~(uintptr_t)(BUFFER_ALIGNMENT - 1));
+        return mem;
+    }
+
+    /**
+      Read up to 'size' bytes of the input into 'buf'.
+      Returns the number of bytes read, 0 at the end of the input. Throws on read errors.
+    */
+    virtual size_t read_into(char* buf, size_t size) = 0;
+
+    int64_t next_chunk(string_view& chunk) override
+    {
+        if (!buf_)
+            buf_ = alloc_aligned(buf_size_, buf_ptr_);
+
+        size_t rv = read_into(buf_ptr_, buf_size_);
+        if (0 == rv)
+            return -1;
+
+        count_chunk(rv);
+        chunk = string_view(buf_ptr_, rv);
+        return (int64_t)rv;
+    }
+
+    size_t chunk_size() const
+    {
+        return buf_size_;
+    }
+
+protected:
+
+    void set_chunk_size(size_t size)
+    {
+        buf_.reset();
+        buf_size_ = size;
+    }
+
+private:
+    std::unique_ptr<char[]> buf_;
+    char* buf_ptr_{nullptr};
+    size_t buf_size_{DEFAULT_CHUNK_SIZE};
+};
+
+/**
+  * Reads the file in large chunks with plain read(2) calls.
+*/
+class raw_file_source : public raw_stream_source
+{
+public:
+    raw_file_source() = default;
+    ~raw_file_source() override { close(); }
+
+    int open(const string& fname, size_t chunk_size = DEFAULT_CHUNK_SIZE, uint64_t start_offset = 0)
+    {
+        close();
+
+#if !defined(_WIN32)
+        if (-1 == (fd_ = ::open(fname.c_str(), O_RDONLY)))
+            return -1;
+        if (start_offset && (off_t)-1 == lseek(fd_, (off_t)start_offset, SEEK_SET))
+        {
+            close();
+            return -1;
+        }
+#if defined(POSIX_FADV_SEQUENTIAL)
+        posix_fadvise(fd_, (off_t)start_offset, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#else
+        if (!(pf_ = fopen(fname.c_str(), "rb")))
+            return -1;
+        if (start_offset && _fseeki64(pf_, (long long)start_offset, SEEK_SET))
+        {
+            close();
+            return -1;
+        }
+        // Our buffer is large enough, skip the C runtime's own buffering
+        setvbuf(pf_, nullptr, _IONBF, 0);
+#endif
+        set_chunk_size(chunk_size);
+        return 0;
+    }
+
+    void close()
+    {
+#if !defined(_WIN32)
+        if (-1 != fd_)
+            ::close(fd_);
+        fd_ = -1;
+#else
+        if (pf_)
+            fclose(pf_);
+        pf_ = nullptr;
+#endif
+    }
+
+    size_t read_into(char* buf, size_t size) override
+    {
+#if !defined(_WIN32)
+        if (-1 == fd_)
+            throw (std::runtime_error("No open input file to read"));
+
+        ssize_t rv;
+        do
+        {
+            rv = ::read(fd_, buf, size);
+        } while (-1 == rv && EINTR == errno);
+
+        if (-1 == rv)
+            throw (std::runtime_error("Error reading the input file"));
+#else
+        if (!pf_)
+            throw (std::runtime_error("No open input file to read"));
+
+        size_t rv = fread(buf, 1, size, pf_);
+        if (0 == rv && ferror(pf_))
+            throw (std::runtime_error("Error reading the input file"));
+#endif
+        return (size_t)rv;
+    }
+
+    const char* name() const override
+    {
+        return "read";
+    }
+
+private:
+#if !defined(_WIN32)
+    int fd_{-1};
+#else
+    FILE* pf_{nullptr};
+#endif
+};
+
+#if !defined(_WIN32)
+
+#if defined(O_DIRECT)
+
+/**
+  * Reads the file with O_DIRECT, bypassing the page cache, for the one-shot conversions of the
+  * inputs much larger than the memory: the data read once is not left behind to evict the working
+  * set of the other processes. The reads are done at block aligned offsets into page aligned
+  * buffers; a start offset is rounded down to the block and the bytes before it are dropped.
+  * There is no kernel read-ahead in this mode, so it is meant to be run behind a read-ahead stage.
+  * 'open' fails on the file systems without O_DIRECT support (e.g. tmpfs).
+*/
+class raw_direct_source : public raw_stream_source
+{
+public:
+    raw_direct_source() = default;
+    ~raw_direct_source() override { close(); }
+
+    int open(const string& fname, size_t chunk_size = DEFAULT_CHUNK_SIZE, uint64_t start_offset = 0)
+    {
+        close();
+
+        if (-1 == (fd_ = ::open(fname.c_str(), O_RDONLY | O_DIRECT)))
+            return -1;
+
+        uint64_t aligned_start = start_offset & ~(uint64_t)(BUFFER_ALIGNMENT - 1);
+        if (aligned_start && (off_t)-1 == lseek(fd_, (off_t)aligned_start, SEEK_SET))
+        {
+            close();
+            return -1;
+        }
+
+        skip_ = (size_t)(start_offset - aligned_start);
+        eof_ = false;
+        set_chunk_size((chunk_size + BUFFER_ALIGNMENT - 1) & ~(BUFFER_ALIGNMENT - 1));
+        return 0;
+    }
+
+    void close()
+    {
+        if (-1 != fd_)
+            ::close(fd_);
+        fd_ = -1;
+        bounce_.reset();
+    }
+
+    size_t read_into(char* buf, size_t size) override
+    {
+        if (-1 == fd_)
+            throw (std::runtime_error("No open input file to read"));
+
+        for (;;)
+        {
+            if (eof_)
+                return 0;
+
+            size_t rv = is_aligned(buf, size) ? read_direct(buf, size) : read_bounced(buf, size);
+
+            // Drop the head of the first block, in front of the requested start offset
+            if (skip_)
+            {
+                size_t skip = skip_ < rv ? skip_ : rv;
+                memmove(buf, buf + skip, rv - skip);
+                skip_ -= skip;
+                rv -= skip;
+                if (0 == rv)
+                    continue;
+            }
+            return rv;
+        }
+    }
+
+    const char* name() const override
+    {
+        return "direct";
+    }
+
+private:
+
+    static bool is_aligned(const char* buf, size_t size)
+    {
+        return 0 == ((uintptr_t)buf & (BUFFER_ALIGNMENT - 1)) && 0 == (size & (BUFFER_ALIGNMENT - 1)) && size;
+    }
+
+    size_t read_direct(char* buf, size_t size)
+    {
+        size_t total = 0;
+        while (total < size)
+        {
+            ssize_t rv = ::read(fd_, buf + total, size - total);
+            if (-1 == rv)
+            {
+                if (EINTR == errno)
+                    continue;
+                throw (std::runtime_error("Error reading the input file"));
+            }
+
+            total += (size_t)rv;
+
+            // Only the last block of the file comes short, after it the offset is no longer aligned
+            if (0 == rv || (total & (BUFFER_ALIGNMENT - 1)))
+            {
+                eof_ = true;
+                break;
+            }
+        }
+        return total;
+    }
+
+    // For the caller's buffers that are not suitably aligned
+    size_t read_bounced(char* buf, size_t size)
+    {
+        size_t aligned_size = (size + BUFFER_ALIGNMENT - 1) & ~(BUFFER_ALIGNMENT - 1);
+        if (!bounce_ || bounce_size_ < aligned_size)
+        {
+            bounce_ = alloc_aligned(aligned_size, bounce_ptr_);
+            bounce_size_ = aligned_size;
+        }
+
+        // Whole blocks only, the data past 'size' would be lost
+        size_t want = size & ~(BUFFER_ALIGNMENT - 1);
+        size_t rv = read_direct(bounce_ptr_, want ? want : BUFFER_ALIGNMENT);
+        if (rv > size)
+            throw (std::runtime_error("The unbuffered reads need buffers of at least one block"));
+
+        memcpy(buf, bounce_ptr_, rv);
+        return rv;
+    }
+
+private:
+    int                     fd_{-1};
+    size_t                  skip_{0};
+    bool                    eof_{false};
+    std::unique_ptr<char[]> bounce_;
+    char*                   bounce_ptr_{nullptr};
+    size_t                  bounce_size_{0};
+};
+
+#endif // O_DIRECT
+
+/**
+  * Reads the standard input, a pipe or a FIFO.
+  * The descriptor is switched to non-blocking mode and drained with large reads until the chunk
+  * is full or the writer falls behind, only then the reader waits in poll(2). This way the chunks
+  * stay large, as with the files, instead of being capped at what a single pipe read returns.
+  * On Linux the pipe buffer is also enlarged, to cut the number of writer/reader switches.
+*/
+class raw_pipe_source : public raw_stream_source
+{
+public:
+    static const int PIPE_BUFFER_SIZE = 1 << 20;
+
+    raw_pipe_source() = default;
+    ~raw_pipe_source() override { close(); }
+
+    // Whether the input name refers to the standard input, a pipe or a FIFO rather than a file
+    static bool is_pipe(const string& fname)
+    {
+        if (fname == "-")
+            return true;
+
+        struct stat st;
+        return 0 == stat(fname.c_str(), &st) && S_ISFIFO(st.st_mode);
+    }
+
+    int open(const string& fname, size_t chunk_size = DEFAULT_CHUNK_SIZE)
+    {
+        close();
+
+        if (fname == "-")
+        {
+            fd_ = STDIN_FILENO;
+            owned_ = false;
+        }
+        else
+        {
+            if (-1 == (fd_ = ::open(fname.c_str(), O_RDONLY)))
+                return -1;
+            owned_ = true;
+        }
+
+        if (-1 == (saved_flags_ = fcntl(fd_, F_GETFL)))
+        {
+            close();
+            return -1;
+        }
+        fcntl(fd_, F_SETFL, saved_flags_ | O_NONBLOCK);
+
+#if defined(F_SETPIPE_SZ)
+        // Best effort, the limit for unprivileged users may be lower
+        fcntl(fd_, F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+#endif
+        set_chunk_size(chunk_size);
+        return 0;
+    }
+
+    void close()
+    {
+        if (-1 != fd_)
+        {
+            // The standard input is shared with the other processes, leave it as we found it
+            if (-1 != saved_flags_)
+                fcntl(fd_, F_SETFL, saved_flags_);
+            if (owned_)
+                ::close(fd_);
+        }
+        fd_ = -1;
+        saved_flags_ = -1;
+    }
+
+    size_t read_into(char* buf, size_t size) override
+    {
+        if (-1 == fd_)
+            throw (std::runtime_error("No open input file to read"));
+
+        size_t total = 0;
+        while (total < size)
+        {
+            ssize_t rv = ::read(fd_, buf + total, size - total);
+            if (rv > 0)
+            {
+                total += (size_t)rv;
+                continue;
+            }
+
+            if (0 == rv)
+                break;
+
+            if (EINTR == errno)
+                continue;
+
+            if (EAGAIN != errno && EWOULDBLOCK != errno)
+                throw (std::runtime_error("Error reading the input pipe"));
+
+            // Hand out what we have rather than stall the parser behind a slow writer
+            if (total)
+                break;
+
+            auto t0 = std::chrono::steady_clock::now();
+            pollfd pfd = { fd_, POLLIN, 0 };
+            if (-1 == poll(&pfd, 1, -1) && EINTR != errno)
+                throw (std::runtime_error("Error waiting for the input pipe"));
+            stats_.wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        }
+
+        return total;
+    }
+
+    const char* name() const override
+    {
+        return "pipe";
+    }
+
+private:
+    int     fd_{-1};
+    int     saved_flags_{-1};
+    bool    owned_{false};
+};
+
+/**
+  * Maps the whole file into memory and hands it out as a single chunk, so the lines are
+  * read in place without copying any bytes.
+*/
+class raw_mapped_source : public raw_data_source
+{
+public:
+    raw_mapped_source() = default;
+    ~raw_mapped_source() override { close(); }
+
+    int open(const string& fname, uint64_t start_offset = 0)
+    {
+        close();
+
+        int fd = ::open(fname.c_str(), O_RDONLY);
+        if (-1 == fd)
+            return -1;
+
+        struct stat st;
+        if (-1 == fstat(fd, &st))
+        {
+            ::close(fd);
+            return -1;
+        }
+
+        size_ = (size_t)st.st_size;
+        if (size_)
+        {
+            void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (MAP_FAILED == p)
+            {
+                ::close(fd);
+                size_ = 0;
+                return -1;
+            }
+
+            // The input is consumed strictly front to back, so let the kernel read ahead aggressively
+            // and drop the pages behind us.
+            madvise(p, size_, MADV_SEQUENTIAL);
+            base_ = (const char*)p;
+        }
+
+        // The mapping keeps its own reference to the file
+        ::close(fd);
+        start_ = start_offset < size_ ? (size_t)start_offset : size_;
+        consumed_ = false;
+        return 0;
+    }
+
+    void close()
+    {
+        if (base_)
+            munmap((void*)base_, size_);
+        base_ = nullptr;
+        size_ = 0;
+    }
+
+    int64_t next_chunk(string_view& chunk) override
+    {
+        if (consumed_ || start_ == size_)
+            return -1;
+
+        consumed_ = true;
+        count_chunk(size_ - start_);
+        chunk = string_view(base_ + start_, size_ - start_);
+        return (int64_t)(size_ - start_);
+    }
+
+    const char* name() const override
+    {
+        return "mmap";
+    }
+
+private:
+    const char* base_{nullptr};
+    size_t      size_{0};
+    size_t      start_{0};
+    bool        consumed_{false};
+};
+
+#endif // !_WIN32
+
+#endif // RAW_DATA_SOURCE_HEADER
@@ -0,0 +1,160 @@
+#ifndef READ_AHEAD_SOURCE_HEADER
+#define READ_AHEAD_SOURCE_HEADER
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json_raw_data_source.h"
+#include "json_spsc_queue.h"
+
+/**
+  * Runs a stream source on a background thread that keeps a pool of large buffers filled ahead
+  * of the reader, so that parsing overlaps with the I/O.
+  * The filled buffers travel to the reader and the drained ones back to the I/O thread through a
+  * pair of lock-free single producer / single consumer queues. The time the reader spends waiting
+  * for a filled buffer is accounted in the stats, telling apart the I/O bound and CPU bound runs.
+*/
+class raw_read_ahead_source : public raw_data_source
+{
+public:
+    static const int DEFAULT_BUFFER_COUNT = 4;
+
+    raw_read_ahead_source(std::unique_ptr<raw_stream_source> src, int buffer_count = DEFAULT_BUFFER_COUNT)
+        : src_(std::move(src))
+        , buffers_(buffer_count < 2 ? 2 : buffer_count)
+        , filled_(buffers_.size() + 1)
+        , drained_(buffers_.size())
+    {
+        for (int i = 0; i < (int)buffers_.size(); ++i)
+        {
+            buffers_[i].mem = raw_stream_source::alloc_aligned(src_->chunk_size(), buffers_[i].data);
+            drained_.push(i);
+        }
+
+        name_ = string(src_->name()) + "+read-ahead";
+        worker_ = std::thread(&raw_read_ahead_source::fill_buffers, this);
+    }
+
+    ~raw_read_ahead_source() override
+    {
+        stop_.store(true, std::memory_order_release);
+        if (worker_.joinable())
+            worker_.join();
+    }
+
+    int64_t next_chunk(string_view& chunk) override
+    {
+        if (eof_)
+            return -1;
+
+        // The previous chunk is no longer referenced by the reader, give its buffer back
+        if (-1 != current_)
+        {
+            drained_.push(current_);
+            current_ = -1;
+        }
+
+        int idx = -1;
+        if (!filled_.pop(idx))
+        {
+            auto t0 = std::chrono::steady_clock::now();
+            wait_for([&]() { return filled_.pop(idx); });
+            stats_.wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        }
+
+        // A negative index marks the end of the input or a failure of the I/O thread
+        if (idx < 0)
+        {
+            eof_ = true;
+            if (!error_.empty())
+                throw (std::runtime_error(error_));
+            return -1;
+        }
+
+        current_ = idx;
+        const buffer& buf = buffers_[idx];
+        count_chunk(buf.size);
+        chunk = string_view(buf.data, buf.size);
+        return (int64_t)buf.size;
+    }
+
+    const char* name() const override
+    {
+        return name_.c_str();
+    }
+
+private:
+
+    struct buffer
+    {
+        std::unique_ptr<char[]> mem;
+        char* data{nullptr};        // Page aligned start of 'mem'
+        size_t size{0};
+    };
+
+    // Spin briefly, then back off to sleeping, until 'cond' holds or the source is being destroyed
+    template <typename Cond>
+    bool wait_for(Cond cond)
+    {
+        for (int spins = 0; !cond(); ++spins)
+        {
+            if (stop_.load(std::memory_order_acquire))
+                return false;
+            if (spins < 64)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        return true;
+    }
+
+    // I/O thread
+    void fill_buffers()
+    {
+        try
+        {
+            for (;;)
+            {
+                int idx;
+                if (!wait_for([&]() { return drained_.pop(idx); }))
+                    return;
+
+                buffer& buf = buffers_[idx];
+                buf.size = src_->read_into(buf.data, src_->chunk_size());
+                if (0 == buf.size)
+                    break;
+
+                filled_.push(idx);
+            }
+        }
+        catch (const std::exception& e)
+        {
+            // Published to the reader by the release store of the queue push below
+            error_ = e.what();
+        }
+
+        filled_.push(-1);
+    }
+
+private:
+    std::unique_ptr<raw_stream_source> src_;
+    std::vector<buffer> buffers_;
+
+    // Buffer indices: filled by the I/O thread, drained by the reader
+    spsc_queue<int>     filled_;
+    spsc_queue<int>     drained_;
+
+    std::thread         worker_;
+    std::atomic<bool>   stop_{false};
+    string              error_;
+    string              name_;
+
+    // Reader side state
+    int                 current_{-1};
+    bool                eof_{false};
+};
+
+#endif // READ_AHEAD_SOURCE_HEADER
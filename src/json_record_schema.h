@@ -0,0 +1,435 @@
+#ifndef JSON_RECORD_SCHEMA_HEADER
+#define JSON_RECORD_SCHEMA_HEADER
+
+#include <stdint.h>
+#include <string.h>
+#include <array>
+#include <charconv>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "json_tlv_serializer.h"
+#include "json_common.h"
+
+/**
+  * Record types declared at compile time, for the feeds whose schema is known in advance:
+  *
+  *     TLV_RECORD(order, (id, uint64_t), (sym, string), (px, double))
+  *
+  * declares the struct 'order' with a member per key, together with the key names and their
+  * expected order in the input. A line matching the declaration exactly (the same keys in the same
+  * order, each value of the declared type) is parsed by the record_schema<order> instantiation:
+  * the keys are checked with compares of their compile-time lengths, each value is parsed and
+  * encoded by the code of its type, with no runtime type switch. The values are narrowed the way the
+  * generic path narrows them (see encode_integer and encode_floating), so that the TLV type of a key
+  * never depends on which path encoded the record. Any other line is left to the generic path.
+  * The supported types are the 8 to 64 bit integers, double, bool and string; the strings may
+  * not hold escape sequences.
+*/
+
+// The parsing and the encoding of a declared field type
+template <typename T, typename Enable = void>
+struct tlv_schema_field;
+
+namespace tlv_schema_detail
+{
+    inline const char* skip_ws(const char* p, const char* end)
+    {
+        while (p != end && (' ' == *p || '\t' == *p || '\r' == *p || '\n' == *p))
+            ++p;
+        return p;
+    }
+
+    /**
+      The end of the JSON number at 'p', in the strict grammar, or nullptr. 'integer' tells that it
+      has neither a fraction nor an exponent.
+    */
+    inline const char* scan_number(const char* p, const char* end, bool& integer)
+    {
+        auto is_digit = [](char c) { return c >= '0' && c <= '9'; };
+
+        integer = true;
+        if (p != end && '-' == *p)
+            ++p;
+        if (p == end || !is_digit(*p))
+            return nullptr;
+        if ('0' == *p++)
+            ;
+        else
+            while (p != end && is_digit(*p))
+                ++p;
+
+        if (p != end && '.' == *p)
+        {
+            integer = false;
+            if (++p == end || !is_digit(*p))
+                return nullptr;
+            while (p != end && is_digit(*p))
+                ++p;
+        }
+        if (p != end && ('e' == *p || 'E' == *p))
+        {
+            integer = false;
+            if (++p != end && ('+' == *p || '-' == *p))
+                ++p;
+            if (p == end || !is_digit(*p))
+                return nullptr;
+            while (p != end && is_digit(*p))
+                ++p;
+        }
+        return p;
+    }
+}
+
+template <typename T>
+struct tlv_schema_field<T, std::enable_if_t<std::is_integral<T>::value && !std::is_same<T, bool>::value>>
+{
+    using value_type = T;
+
+    // An integer in the range of T, a negative one fails the conversion of the unsigned types
+    static const char* parse(const char* p, const char* end, value_type& v)
+    {
+        bool integer;
+        const char* num_end = tlv_schema_detail::scan_number(p, end, integer);
+        if (!num_end || !integer)
+            return nullptr;
+        std::from_chars_result rv = std::from_chars(p, num_end, v);
+        return std::errc() == rv.ec && rv.ptr == num_end ? num_end : nullptr;
+    }
+
+    // In the narrowest integer type, as the generic path writes it
+    static void append(tlv_data_serializer& ds, const value_type& v)
+    {
+        uint64_t bits = (uint64_t)v;
+        bool negative = std::is_signed<T>::value && (int64_t)bits < 0;
+        ds.append_tlv(encode_integer(bits, negative, integer_width_class(bits, negative)));
+    }
+};
+
+template <>
+struct tlv_schema_field<double>
+{
+    using value_type = double;
+
+    /**
+      The integers written without a fraction are taken only where encode_floating encodes them as
+      the generic path encodes an integer: in the 32-bit range and not a negative zero. The others
+      are left to the generic path.
+    */
+    static const char* parse(const char* p, const char* end, value_type& v)
+    {
+        bool integer;
+        const char* num_end = tlv_schema_detail::scan_number(p, end, integer);
+        if (!num_end)
+            return nullptr;
+        std::from_chars_result rv = std::from_chars(p, num_end, v);
+        if (std::errc() != rv.ec || rv.ptr != num_end)
+            return nullptr;
+        if (integer && (!(v >= -2147483648.0 && v <= 4294967295.0) || (0 == v && '-' == *p)))
+            return nullptr;
+        return num_end;
+    }
+
+    // As an integer, a float or a double, the smallest that holds the value exactly
+    static void append(tlv_data_serializer& ds, const value_type& v)
+    {
+        ds.append_tlv(encode_floating(v));
+    }
+};
+
+template <>
+struct tlv_schema_field<bool>
+{
+    using value_type = bool;
+    static constexpr tlv_type tag = tlv_type::TLVT_UINT8;
+
+    static const char* parse(const char* p, const char* end, value_type& v)
+    {
+        if (end - p >= 4 && 0 == memcmp(p, "true", 4))
+        {
+            v = true;
+            return p + 4;
+        }
+        if (end - p >= 5 && 0 == memcmp(p, "false", 5))
+        {
+            v = false;
+            return p + 5;
+        }
+        return nullptr;
+    }
+
+    static void append(tlv_data_serializer& ds, const value_type& v)
+    {
+        uint8_t b = v;
+        ds.append_tlv(tag, &b, sizeof(b));
+    }
+};
+
+// The member is a view into the parsed line
+template <>
+struct tlv_schema_field<std::string>
+{
+    using value_type = std::string_view;
+    static constexpr tlv_type tag = tlv_type::TLVT_STRING;
+
+    // The line is valid UTF-8 already, only the escapes and the control characters are left out
+    static const char* parse(const char* p, const char* end, value_type& v)
+    {
+        if (p == end || '"' != *p)
+            return nullptr;
+        const char* beg = ++p;
+        while (p != end && '"' != *p)
+        {
+            if ('\\' == *p || (unsigned char)*p < 0x20)
+                return nullptr;
+            ++p;
+        }
+        if (p == end)
+            return nullptr;
+        v = std::string_view(beg, p - beg);
+        return p + 1;
+    }
+
+    static void append(tlv_data_serializer& ds, const value_type& v)
+    {
+        ds.append_string_tlv(v);
+    }
+};
+
+namespace tlv_schema_detail
+{
+    // The positions of the keys sorted by their bytes, the order of the DOM object (a std::map)
+    template <typename Record, size_t N = Record::key_names.size()>
+    constexpr std::array<size_t, N> sorted_key_order()
+    {
+        std::array<size_t, N> order{};
+        for (size_t i = 0; i < N; ++i)
+            order[i] = i;
+        for (size_t i = 1; i < N; ++i)
+            for (size_t j = i; j > 0 && Record::key_names[order[j]] < Record::key_names[order[j - 1]]; --j)
+            {
+                size_t t = order[j];
+                order[j] = order[j - 1];
+                order[j - 1] = t;
+            }
+        return order;
+    }
+
+    template <typename Record>
+    constexpr bool unique_keys()
+    {
+        constexpr auto order = sorted_key_order<Record>();
+        for (size_t i = 1; i < order.size(); ++i)
+            if (Record::key_names[order[i]] == Record::key_names[order[i - 1]])
+                return false;
+        return true;
+    }
+}
+
+/**
+  * The runtime side of a declared record type, as the processor holds it.
+*/
+class record_schema_base
+{
+public:
+    using string_view = std::string_view;
+    using key_mapper = std::function<dictionary_value_type(string_view)>;
+
+    virtual ~record_schema_base() = default;
+
+    virtual const char* name() const = 0;
+
+    /**
+      Encode 'line' as a record if it matches the declaration, with its keys in the input order or
+      else in the DOM order. The key IDs are taken from 'map_key' for the first record only, in the
+      output order, as the flat path would map the keys of a new record.
+      Returns false, with nothing written, if the line does not match.
+    */
+    virtual bool encode(string_view line, tlv_data_serializer& ds, bool input_order, const key_mapper& map_key) = 0;
+
+    // The keys in the order 'encode' writes them
+    virtual const std::vector<string_view>& output_keys(bool input_order) const = 0;
+};
+
+template <typename Record>
+class record_schema : public record_schema_base
+{
+public:
+    static constexpr size_t N = Record::key_names.size();
+    static_assert(tlv_schema_detail::unique_keys<Record>(), "the keys of a record must be unique");
+
+    record_schema()
+        : input_keys_(Record::key_names.begin(), Record::key_names.end())
+    {
+        for (size_t k : dom_order)
+            dom_keys_.push_back(Record::key_names[k]);
+    }
+
+    const char* name() const override
+    {
+        return Record::record_name;
+    }
+
+    bool encode(string_view line, tlv_data_serializer& ds, bool input_order, const key_mapper& map_key) override
+    {
+        Record rec;
+        if (!parse(line, rec, std::make_index_sequence<N>()))
+            return false;
+
+        if (!resolved_)
+        {
+            for (size_t i = 0; i < N; ++i)
+                ids_[input_order ? i : dom_order[i]] = map_key(Record::key_names[input_order ? i : dom_order[i]]);
+            resolved_ = true;
+        }
+
+        ds.begin_record();
+        if (input_order)
+            emit_input_order(rec, ds, std::make_index_sequence<N>());
+        else
+            emit_dom_order(rec, ds, std::make_index_sequence<N>());
+        return true;
+    }
+
+    const std::vector<string_view>& output_keys(bool input_order) const override
+    {
+        return input_order ? input_keys_ : dom_keys_;
+    }
+
+private:
+
+    static constexpr std::array<size_t, N> dom_order = tlv_schema_detail::sorted_key_order<Record>();
+
+    template <size_t I>
+    using field = tlv_schema_field<std::tuple_element_t<I, typename Record::field_types>>;
+
+    // The field I: its quoted key by a compare of a fixed length, the colon, the value and the separator
+    template <size_t I>
+    static bool parse_field(const char*& p, const char* end, Record& rec)
+    {
+        constexpr std::string_view key = Record::key_names[I];
+
+        p = tlv_schema_detail::skip_ws(p, end);
+        if ((size_t)(end - p) < key.size() + 2 || '"' != p[0] || 0 != memcmp(p + 1, key.data(), key.size()) || '"' != p[key.size() + 1])
+            return false;
+        p = tlv_schema_detail::skip_ws(p + key.size() + 2, end);
+        if (p == end || ':' != *p)
+            return false;
+
+        p = field<I>::parse(tlv_schema_detail::skip_ws(p + 1, end), end, rec.*std::get<I>(Record::members()));
+        if (!p)
+            return false;
+
+        p = tlv_schema_detail::skip_ws(p, end);
+        if (p == end || (I + 1 < N ? ',' : '}') != *p)
+            return false;
+        ++p;
+        return true;
+    }
+
+    template <size_t... I>
+    static bool parse(string_view line, Record& rec, std::index_sequence<I...>)
+    {
+        const char* end = line.data() + line.size();
+        const char* p = tlv_schema_detail::skip_ws(line.data(), end);
+        if (p == end || '{' != *p++)
+            return false;
+        if (!(parse_field<I>(p, end, rec) && ...))
+            return false;
+        return tlv_schema_detail::skip_ws(p, end) == end;
+    }
+
+    template <size_t K>
+    void emit_field(const Record& rec, tlv_data_serializer& ds) const
+    {
+        int32_t mapped_key = ids_[K];
+        ds.append_tlv(tlv_type::TLVT_INT32, &mapped_key, sizeof(mapped_key));
+        field<K>::append(ds, rec.*std::get<K>(Record::members()));
+    }
+
+    template <size_t... I>
+    void emit_input_order(const Record& rec, tlv_data_serializer& ds, std::index_sequence<I...>) const
+    {
+        (emit_field<I>(rec, ds), ...);
+    }
+
+    template <size_t... I>
+    void emit_dom_order(const Record& rec, tlv_data_serializer& ds, std::index_sequence<I...>) const
+    {
+        (emit_field<dom_order[I]>(rec, ds), ...);
+    }
+
+private:
+    std::array<dictionary_value_type, N>    ids_{};
+    bool                                    resolved_{false};
+    std::vector<string_view>                input_keys_;
+    std::vector<string_view>                dom_keys_;
+};
+
+// The preprocessor part: a macro applied to each (key, type) pair of the declaration, up to 16
+#define TLV_PP_EXPAND(x) x
+#define TLV_PP_CAT_(a, b) a##b
+#define TLV_PP_CAT(a, b) TLV_PP_CAT_(a, b)
+#define TLV_PP_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, N, ...) N
+#define TLV_PP_NARGS(...) TLV_PP_EXPAND(TLV_PP_NARGS_(__VA_ARGS__, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1))
+
+#define TLV_PP_FE_1(M, x) M x
+#define TLV_PP_FE_2(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_1(M, __VA_ARGS__))
+#define TLV_PP_FE_3(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_2(M, __VA_ARGS__))
+#define TLV_PP_FE_4(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_3(M, __VA_ARGS__))
+#define TLV_PP_FE_5(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_4(M, __VA_ARGS__))
+#define TLV_PP_FE_6(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_5(M, __VA_ARGS__))
+#define TLV_PP_FE_7(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_6(M, __VA_ARGS__))
+#define TLV_PP_FE_8(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_7(M, __VA_ARGS__))
+#define TLV_PP_FE_9(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_8(M, __VA_ARGS__))
+#define TLV_PP_FE_10(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_9(M, __VA_ARGS__))
+#define TLV_PP_FE_11(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_10(M, __VA_ARGS__))
+#define TLV_PP_FE_12(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_11(M, __VA_ARGS__))
+#define TLV_PP_FE_13(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_12(M, __VA_ARGS__))
+#define TLV_PP_FE_14(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_13(M, __VA_ARGS__))
+#define TLV_PP_FE_15(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_14(M, __VA_ARGS__))
+#define TLV_PP_FE_16(M, x, ...) M x TLV_PP_EXPAND(TLV_PP_FE_15(M, __VA_ARGS__))
+#define TLV_PP_FOR_EACH(M, ...) TLV_PP_EXPAND(TLV_PP_CAT(TLV_PP_FE_, TLV_PP_NARGS(__VA_ARGS__))(M, __VA_ARGS__))
+
+#define TLV_RECORD_MEMBER(key, type) typename tlv_schema_field<type>::value_type key{};
+#define TLV_RECORD_KEY_NAME(key, type) #key,
+#define TLV_RECORD_TYPE(key, type) , type
+#define TLV_RECORD_MEMBER_PTR(key, type) , &self_type::key
+
+namespace tlv_schema_detail
+{
+    // Drop the leading placeholder of the lists built with a separator ahead of every element
+    template <typename Ignored, typename... T>
+    struct tail_types
+    {
+        using type = std::tuple<T...>;
+    };
+
+    template <typename... P>
+    constexpr auto member_list(int, P... p)
+    {
+        return std::make_tuple(p...);
+    }
+}
+
+#define TLV_RECORD(name, ...)                                                                           \
+    struct name                                                                                         \
+    {                                                                                                   \
+        using self_type = name;                                                                         \
+        static constexpr const char* record_name = #name;                                               \
+        TLV_PP_FOR_EACH(TLV_RECORD_MEMBER, __VA_ARGS__)                                                 \
+        static constexpr std::array<std::string_view, TLV_PP_NARGS(__VA_ARGS__)> key_names = {         \
+            { TLV_PP_FOR_EACH(TLV_RECORD_KEY_NAME, __VA_ARGS__) } };                                    \
+        using field_types = typename tlv_schema_detail::tail_types<void                                 \
+            TLV_PP_FOR_EACH(TLV_RECORD_TYPE, __VA_ARGS__)>::type;                                       \
+        static constexpr auto members()                                                                 \
+        {                                                                                               \
+            return tlv_schema_detail::member_list(0 TLV_PP_FOR_EACH(TLV_RECORD_MEMBER_PTR, __VA_ARGS__)); \
+        }                                                                                               \
+    };
+
+#endif // JSON_RECORD_SCHEMA_HEADER
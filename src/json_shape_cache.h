@@ -0,0 +1,118 @@
+#ifndef JSON_SHAPE_CACHE_HEADER
+#define JSON_SHAPE_CACHE_HEADER
+
+#include <stdint.h>
+#include <string.h>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "json_flat_parser.h"
+#include "json_common.h"
+
+/**
+  * The shape of a flat record: its keys in the input order with their dictionary IDs, and the
+  * order in which its fields are written out.
+*/
+struct record_shape
+{
+    // Marks a key whose ID is not known yet
+    static constexpr dictionary_value_type NO_ID = std::numeric_limits<dictionary_value_type>::min();
+
+    std::string                         keys;       // The key bytes back to back
+    std::vector<uint32_t>               ends;       // End offset of each key in 'keys'
+    std::vector<dictionary_value_type>  ids;        // The ID of each key
+    std::vector<uint32_t>               order;      // Input positions of the fields, in the output order
+
+    /**
+      Check the keys of 'fields' against the shape, position by position, each with a single
+      compare. 'ids' receives the ID of every key predicted right and NO_ID for the others.
+      Returns the number of the keys predicted right.
+    */
+    size_t match(const std::vector<flat_field>& fields, std::vector<dictionary_value_type>& ids_out) const
+    {
+        ids_out.resize(fields.size());
+
+        size_t hits = 0;
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            ids_out[i] = NO_ID;
+            if (i >= ends.size())
+                continue;
+
+            uint32_t beg = i ? ends[i - 1] : 0;
+            std::string_view key = fields[i].key;
+            if (key.size() == ends[i] - beg && 0 == memcmp(key.data(), keys.data() + beg, key.size()))
+            {
+                ids_out[i] = ids[i];
+                ++hits;
+            }
+        }
+        return hits;
+    }
+
+    // Remember the record as the prediction for its slot
+    void store(const std::vector<flat_field>& fields, const std::vector<dictionary_value_type>& ids_in,
+               const std::vector<uint32_t>& order_in)
+    {
+        keys.clear();
+        ends.clear();
+        for (const flat_field& f : fields)
+        {
+            keys.append(f.key.data(), f.key.size());
+            ends.push_back((uint32_t)keys.size());
+        }
+        ids = ids_in;
+        order = order_in;
+    }
+};
+
+/**
+  * Cache of the recently seen record shapes, to skip the dictionary lookups of the keys.
+  * Most records of a feed share a handful of key sequences; the shape of a record is predicted
+  * from its field count and first key, and every key found at its predicted position reuses the
+  * predicted ID. Only the keys predicted wrong go to the dictionary, after which the record
+  * replaces the prediction of its slot. The shapes only hold IDs taken from the dictionary, which
+  * never change once assigned, so a stale prediction costs a lookup but never a wrong ID.
+*/
+class record_shape_cache
+{
+public:
+    static const size_t SLOTS = 64;
+
+    record_shape_cache()
+        : slots_(SLOTS)
+    {}
+
+    record_shape& predict(const std::vector<flat_field>& fields)
+    {
+        size_t h = fields.size() * 0x9e3779b97f4a7c15ull;
+        if (!fields.empty())
+            h ^= std::hash<std::string_view>()(fields[0].key);
+        return slots_[h & (SLOTS - 1)];
+    }
+
+    // Count the keys of a record and the ones predicted right, for the statistics
+    void count(size_t keys, size_t hits, bool same_shape)
+    {
+        keys_ += keys;
+        hits_ += hits;
+        ++records_;
+        if (same_shape)
+            ++record_hits_;
+    }
+
+    uint64_t keys() const           { return keys_; }
+    uint64_t hits() const           { return hits_; }
+    uint64_t records() const        { return records_; }
+    uint64_t record_hits() const    { return record_hits_; }
+
+private:
+    std::vector<record_shape>   slots_;
+    uint64_t                    keys_{0};
+    uint64_t                    hits_{0};
+    uint64_t                    records_{0};
+    uint64_t                    record_hits_{0};
+};
+
+#endif // JSON_SHAPE_CACHE_HEADER
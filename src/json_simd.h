@@ -0,0 +1,98 @@
+#ifndef JSON_SIMD_HEADER
+#define JSON_SIMD_HEADER
+
+#include <stddef.h>
+#include <string.h>
+
+/**
+  * Vectorized byte scanning kernels used by the input stage.
+  * On x86 the best kernel supported by the running CPU (AVX2, then SSE2) is selected once at the
+  * first call, every other platform uses the C runtime's memchr as the scalar fallback.
+*/
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define JSON_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+inline const char* simd_find_byte_scalar(const char* pbeg, const char* pend, char ch)
+{
+    return (const char*)memchr(pbeg, ch, (size_t)(pend - pbeg));
+}
+
+#if defined(JSON_SIMD_X86)
+
+__attribute__((target("sse2")))
+inline const char* simd_find_byte_sse2(const char* pbeg, const char* pend, char ch)
+{
+    const __m128i needle = _mm_set1_epi8(ch);
+    const char* p = pbeg;
+
+    for (; p + 16 <= pend; p += 16)
+    {
+        __m128i blk = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(blk, needle));
+        if (mask)
+            return p + __builtin_ctz((unsigned)mask);
+    }
+
+    return simd_find_byte_scalar(p, pend, ch);
+}
+
+__attribute__((target("avx2")))
+inline const char* simd_find_byte_avx2(const char* pbeg, const char* pend, char ch)
+{
+    const __m256i needle = _mm256_set1_epi8(ch);
+    const char* p = pbeg;
+
+    // Two vectors per iteration, the common case for short records is a hit in the first one
+    for (; p + 64 <= pend; p += 64)
+    {
+        __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(p + 32));
+        unsigned mlo = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle));
+        unsigned mhi = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle));
+        if (mlo)
+            return p + __builtin_ctz(mlo);
+        if (mhi)
+            return p + 32 + __builtin_ctz(mhi);
+    }
+
+    for (; p + 32 <= pend; p += 32)
+    {
+        __m256i blk = _mm256_loadu_si256((const __m256i*)p);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(blk, needle));
+        if (mask)
+            return p + __builtin_ctz(mask);
+    }
+
+    return simd_find_byte_scalar(p, pend, ch);
+}
+
+#endif // JSON_SIMD_X86
+
+using simd_find_byte_fn = const char* (*)(const char*, const char*, char);
+
+inline simd_find_byte_fn simd_select_find_byte()
+{
+#if defined(JSON_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return simd_find_byte_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return simd_find_byte_sse2;
+#endif
+    return simd_find_byte_scalar;
+}
+
+/**
+  Find the first Lf in [pbeg, pend). Returns nullptr if there is none.
+  A CrLf pair is found through its Lf, the caller strips the Cr.
+*/
+inline const char* simd_find_newline(const char* pbeg, const char* pend)
+{
+    static const simd_find_byte_fn find_byte = simd_select_find_byte();
+    return find_byte(pbeg, pend, '\n');
+}
+
+#endif // JSON_SIMD_HEADER
@@ -0,0 +1,66 @@
+#ifndef JSON_SPSC_QUEUE_HEADER
+#define JSON_SPSC_QUEUE_HEADER
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+
+/**
+  * Bounded lock-free queue for exactly one producer thread and one consumer thread.
+  * The head is only written by the consumer and the tail only by the producer, each side
+  * publishes its index with a release store that the other side reads with an acquire load.
+  * Both indices are kept on their own cache lines to avoid false sharing.
+*/
+template <typename T>
+class spsc_queue
+{
+public:
+
+    explicit spsc_queue(size_t capacity)
+        : size_(capacity + 1), slots_(new T[capacity + 1])
+    {}
+
+    spsc_queue(const spsc_queue&) = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+
+    // Producer side. Returns false if the queue is full.
+    bool push(const T& val)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t nxt = next(tail);
+        if (nxt == head_.load(std::memory_order_acquire))
+            return false;
+
+        slots_[tail] = val;
+        tail_.store(nxt, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false if the queue is empty.
+    bool pop(T& val)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire))
+            return false;
+
+        val = slots_[head];
+        head_.store(next(head), std::memory_order_release);
+        return true;
+    }
+
+private:
+
+    size_t next(size_t idx) const
+    {
+        return ++idx == size_ ? 0 : idx;
+    }
+
+private:
+    const size_t            size_;
+    std::unique_ptr<T[]>    slots_;
+
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+#endif // JSON_SPSC_QUEUE_HEADER
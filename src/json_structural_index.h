@@ -0,0 +1,277 @@
+#ifndef JSON_STRUCTURAL_INDEX_HEADER
+#define JSON_STRUCTURAL_INDEX_HEADER
+
+#include <stdint.h>
+#include <string.h>
+#include <string_view>
+#include <vector>
+#include "json_simd.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+/**
+  * Character class bitmaps of a 64 byte block of the input, bit i standing for the byte i.
+*/
+struct structural_block
+{
+    uint64_t quote{0};          // "
+    uint64_t backslash{0};      // '\'
+    uint64_t op{0};             // { } [ ] : ,
+    uint64_t ws{0};             // Space, Tab, Cr, Lf
+    uint64_t control{0};        // The control characters, below 0x20
+};
+
+inline void classify_blocks_scalar(const char* p, size_t count, structural_block* blocks)
+{
+    for (size_t k = 0; k < count; ++k, p += 64)
+    {
+        structural_block& b = blocks[k];
+        b = structural_block();
+        for (int i = 0; i < 64; ++i)
+        {
+            unsigned char c = (unsigned char)p[i];
+            uint64_t bit = 1ull << i;
+            switch (c)
+            {
+            case '"':
+                b.quote |= bit;
+                break;
+            case '\\':
+                b.backslash |= bit;
+                break;
+            case '{': case '}': case '[': case ']': case ':': case ',':
+                b.op |= bit;
+                break;
+            case ' ': case '\t': case '\r': case '\n':
+                b.ws |= bit;
+                break;
+            }
+            if (c < 0x20)
+                b.control |= bit;
+        }
+    }
+}
+
+#if defined(JSON_SIMD_X86)
+
+__attribute__((target("sse2")))
+inline void classify_blocks_sse2(const char* p, size_t count, structural_block* blocks)
+{
+    for (size_t k = 0; k < count; ++k, p += 64)
+    {
+        structural_block& b = blocks[k];
+        b = structural_block();
+        for (int i = 0; i < 4; ++i)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * i));
+            // '{' and '[' as well as '}' and ']' differ in the 0x20 bit only
+            __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+            __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))),
+                                      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')), _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+            __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                                      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+            int shift = 16 * i;
+            b.quote |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << shift;
+            b.backslash |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << shift;
+            b.op |= (uint64_t)(unsigned)_mm_movemask_epi8(op) << shift;
+            b.ws |= (uint64_t)(unsigned)_mm_movemask_epi8(ws) << shift;
+            // No bit above 0x1f set, as SSE2 has no unsigned compare
+            b.control |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8((char)0xe0)), _mm_setzero_si128())) << shift;
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+inline void classify_blocks_avx2(const char* p, size_t count, structural_block* blocks)
+{
+    for (size_t k = 0; k < count; ++k, p += 64)
+    {
+        structural_block& b = blocks[k];
+        b = structural_block();
+        for (int i = 0; i < 2; ++i)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(p + 32 * i));
+            __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+            __m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}'))),
+                                         _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+            __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+                                         _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+            int shift = 32 * i;
+            b.quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << shift;
+            b.backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << shift;
+            b.op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << shift;
+            b.ws |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << shift;
+            b.control |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8((char)0xe0)), _mm256_setzero_si256())) << shift;
+        }
+    }
+}
+
+#endif // JSON_SIMD_X86
+
+// Classify 'count' consecutive 64 byte blocks
+using classify_blocks_fn = void (*)(const char*, size_t, structural_block*);
+
+inline classify_blocks_fn select_classify_blocks()
+{
+#if defined(JSON_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return classify_blocks_avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return classify_blocks_sse2;
+#endif
+    return classify_blocks_scalar;
+}
+
+/**
+  * The first stage of the flat record parser, in the manner of simdjson.
+  * The line is classified 64 bytes at a time into bitmaps, the quotes escaped by backslashes are
+  * discarded, the string interiors are found with a prefix XOR of the remaining quotes, and the
+  * positions of the structural characters outside the strings, of the quotes and of the first
+  * bytes of the scalars (numbers and literals) are written out. The parser then jumps from one
+  * structural position to the next instead of looking at every byte. Garbage between the tokens
+  * shows up as an unexpected scalar start, so the parser needs no separate check for it.
+*/
+class structural_indexer
+{
+public:
+    using string_view = std::string_view;
+
+    // Blocks classified per call of the vectorized kernel
+    static const size_t BATCH_BLOCKS = 16;
+
+    /**
+      Index 'line' into 'positions'. The vector is used as a buffer, it is only ever grown and its
+      size is not the number of the positions.
+      Returns the number of the structural positions or -1 if the line ends within a string.
+    */
+    int index(string_view line, std::vector<uint32_t>& positions)
+    {
+        static const classify_blocks_fn classify = select_classify_blocks();
+
+        string_escapes_ = string_controls_ = false;
+
+        // Room for the worst case of a structural position per byte, plus the padding of the last block
+        if (positions.size() < line.size() + 64)
+            positions.resize(line.size() + 64);
+        uint32_t* out = positions.data();
+
+        uint64_t prev_escaped = 0;      // The first byte of the block is escaped
+        uint64_t prev_in_string = 0;    // All ones if the previous block ended within a string
+        uint64_t prev_scalar = 0;       // The previous block ended with a scalar byte
+
+        const char* p = line.data();
+        size_t len = line.size();
+        structural_block blocks[BATCH_BLOCKS];
+
+        for (size_t base = 0; base < len; )
+        {
+            // Classify a batch of the whole blocks in one call, or else the padded last block
+            size_t count = (len - base) / 64;
+            if (count > BATCH_BLOCKS)
+                count = BATCH_BLOCKS;
+            if (count)
+                classify(p + base, count, blocks);
+            else
+            {
+                char tail[64];
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, p + base, len - base);
+                classify(tail, 1, blocks);
+                count = 1;
+            }
+
+            for (size_t k = 0; k < count; ++k, base += 64)
+            {
+                const structural_block& b = blocks[k];
+
+                uint64_t escaped = find_escaped(b.backslash, prev_escaped);
+                uint64_t quote = b.quote & ~escaped;
+
+                // Set from the opening quote up to the byte before the closing one
+                uint64_t in_string = prefix_xor(quote) ^ prev_in_string;
+                prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+
+                uint64_t interior = in_string & ~quote;
+                string_escapes_ |= 0 != (interior & b.backslash);
+                string_controls_ |= 0 != (interior & b.control);
+
+                uint64_t outside = ~(in_string | quote);
+                uint64_t scalar = outside & ~(b.op | b.ws);
+                uint64_t scalar_start = scalar & ~((scalar << 1) | prev_scalar);
+                prev_scalar = scalar >> 63;
+
+                for (uint64_t structural = (b.op & outside) | quote | scalar_start; structural; structural &= structural - 1)
+                    *out++ = (uint32_t)(base + count_trailing_zeros(structural));
+            }
+        }
+
+        return 0 == prev_in_string ? (int)(out - positions.data()) : -1;
+    }
+
+    // Some string of the last line indexed holds a backslash escape
+    bool string_escapes() const
+    {
+        return string_escapes_;
+    }
+
+    // Some string of the last line indexed holds a control character, which JSON does not allow
+    bool string_controls() const
+    {
+        return string_controls_;
+    }
+
+private:
+
+    static unsigned count_trailing_zeros(uint64_t x)
+    {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanForward64(&idx, x);
+        return (unsigned)idx;
+#else
+        return (unsigned)__builtin_ctzll(x);
+#endif
+    }
+
+    // Bit i becomes the XOR of the bits 0..i, turning the quote bits into the string ranges
+    static uint64_t prefix_xor(uint64_t x)
+    {
+        x ^= x << 1;
+        x ^= x << 2;
+        x ^= x << 4;
+        x ^= x << 8;
+        x ^= x << 16;
+        x ^= x << 32;
+        return x;
+    }
+
+    /**
+      The bytes escaped by a backslash: the ones following an odd length run of backslashes.
+      The runs are told apart by adding their starts to them, which carries through each run and
+      flips the parity of the runs starting at an odd position. 'prev_escaped' carries a run
+      crossing the block end over to the next block.
+    */
+    static uint64_t find_escaped(uint64_t backslash, uint64_t& prev_escaped)
+    {
+        const uint64_t even_bits = 0x5555555555555555ull;
+
+        backslash &= ~prev_escaped;
+        uint64_t follows_escape = (backslash << 1) | prev_escaped;
+        uint64_t odd_sequence_starts = backslash & ~even_bits & ~follows_escape;
+
+        uint64_t sequences_starting_on_even_bits = odd_sequence_starts + backslash;
+        prev_escaped = sequences_starting_on_even_bits < backslash ? 1 : 0;
+
+        uint64_t invert_mask = sequences_starting_on_even_bits << 1;
+        return (even_bits ^ invert_mask) & follows_escape;
+    }
+
+private:
+    bool string_escapes_{false};
+    bool string_controls_{false};
+};
+
+#endif // JSON_STRUCTURAL_INDEX_HEADER
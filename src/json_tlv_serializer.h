@@ -2,23 +2,44 @@
 #define TLV_SERIALIZER_HEADER
 
 #include <stdio.h>
+#include <string.h>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <map>
 #include <memory>
+#include <stdexcept>
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include "json_tlv_value.h"
+#include "json_key_dictionary.h"
 #include "json_common.h"
 
 using std::vector;
-using std::map;
 
+/**
+  * Writes and reads back the TLV objects of a backing file.
+  * The output is gathered in a memory buffer and goes to the file in large writes. The fused
+  * encoders append the objects of a record straight into that buffer ('begin_record' and the
+  * 'append_*' calls), with no tlv_value in between, and may drop a half encoded record again.
+*/
 class tlv_data_serializer
 {
 public:
     using string = std::string;
+    using string_view = std::string_view;
+
+    // Amount of the output gathered in memory before it is written to the backing file
+    static const size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+
+    // Bytes of a TLV object ahead of its value: the type and the length
+    static const size_t TLV_HEADER_SIZE = 1 + sizeof(tlv_value::size_type);
     
     tlv_data_serializer() = default;
-    ~tlv_data_serializer() { if (pf_) fclose(pf_); }
+    ~tlv_data_serializer() { close(); }
 
     /**
       Initialize the backing file.
@@ -26,16 +47,113 @@ public:
     */
     int init(const string& fname) 
     {
+        close();
         if (!(pf_ = fopen(fname.c_str(), "w+b")))   
             return -1;
         return 0;
     }
+
+    // Open an existing backing file for reading only
+    int open_existing(const string& fname)
+    {
+        close();
+        if (!(pf_ = fopen(fname.c_str(), "rb")))
+            return -1;
+        read_end_ = file_size();
+        return 0;
+    }
+
+    /**
+      Open an existing backing file for both reading and writing, cut it at 'offset' and
+      position the writes there. Used to continue an interrupted output.
+    */
+    int reopen_at(const string& fname, uint64_t offset)
+    {
+        close();
+        if (!(pf_ = fopen(fname.c_str(), "r+b")))
+            return -1;
+
+#if defined(_WIN32)
+        if (_chsize_s(_fileno(pf_), (long long)offset) || _fseeki64(pf_, (long long)offset, SEEK_SET))
+            return -1;
+#else
+        if (ftruncate(fileno(pf_), (off_t)offset) || fseeko(pf_, (off_t)offset, SEEK_SET))
+            return -1;
+#endif
+        return 0;
+    }
+
+    // Current position in the backing file, counting the buffered output
+    uint64_t tell()
+    {
+        if (!pf_)
+            return 0;
+#if defined(_WIN32)
+        return (uint64_t)_ftelli64(pf_) + out_.size();
+#else
+        return (uint64_t)ftello(pf_) + out_.size();
+#endif
+    }
+
+    /**
+      Read back a TLV object written by 'write_tlv_object'.
+      Returns 0 on success, -1 at the end of the file right at an object boundary, and -2 on
+      an object cut short or claiming more bytes than the file has left (not a TLV file).
+    */
+    int read_tlv_object(tlv_value& tl)
+    {
+        if (!pf_)
+            throw (std::runtime_error("No open input file to read"));
+
+        tlv_type typ;
+        tlv_value::size_type sz;
+        if (1 != fread((void*)&typ, sizeof(tlv_type), 1, pf_))
+            return feof(pf_) && !ferror(pf_) ? -1 : -2;
+        if (1 != fread((void*)&sz, sizeof(sz), 1, pf_))
+            return -2;
+
+        // Checked ahead of the allocation, the length of a garbage header may be anything up to 4 GB
+        uint64_t end = read_end_ ? read_end_ : file_size();
+        uint64_t pos = position();
+        if (pos > end || sz > end - pos)
+            return -2;
+
+        std::unique_ptr<char[]> pbuf(new char[sz ? sz : 1]);
+        if (sz && 1 != fread((void*)pbuf.get(), sz, 1, pf_))
+            return -2;
+
+        tl = tlv_value(typ, pbuf.get(), sz);
+        return 0;
+    }
+
+    /**
+      Read back a key mapping written by 'dump_map', from the current position to the end of the file.
+      Returns -1 unless the file ends cleanly after a well formed pair (or holds none), i.e. on a
+      malformed pair, a truncated object or a file that is not a dictionary.
+    */
+    int load_map(key_dictionary& keys)
+    {
+        tlv_value tlkey, tlval;
+        int rv;
+        while (0 == (rv = read_tlv_object(tlkey)))
+        {
+            if (0 != read_tlv_object(tlval))
+                return -1;
+
+            if (tlkey.type() != tlv_type::TLVT_STRING || tlval.type() != tlv_type::TLVT_INT16)
+                return -1;
+
+            keys.assign(tlkey.get_value_as<string>(), tlval.get_value_as<dictionary_value_type>());
+        }
+        return -1 == rv ? 0 : -1;
+    }
     
-    int dump_map(const map<string, dictionary_value_type>& keys)
+    // The pairs are written sorted by the key bytes
+    int dump_map(const key_dictionary& keys)
     {
-        for (auto& [k, v] : keys)
+        for (auto& [k, v] : keys.sorted_entries())
         {
-            tlv_value tlkey(k);
+            tlv_value tlkey = tlv_value::from_string(k);
             tlv_value tlval(v);
 
             write_tlv_object(tlkey);
@@ -44,8 +162,10 @@ public:
         return 0;
     }
 
+    // Write the objects of a record
     int dump_to_file(const vector<tlv_value>& tlvs)
     {
+        begin_record();
         for (int i = 0; i < (int)tlvs.size(); ++i)
         {
             write_tlv_object(tlvs[i]);
@@ -54,13 +174,56 @@ public:
         return 0;
     }
 
+    /**
+      Start a record for the fused encoders. The buffered output is written out first if it has
+      grown large, then the record stays in the buffer at least until the next one starts.
+    */
+    void begin_record()
+    {
+        if (out_.size() >= OUTPUT_BUFFER_SIZE)
+            write_out();
+        record_start_ = out_.size();
+    }
+
+    // Drop what has been appended since 'begin_record', e.g. on a parse failure halfway
+    void rollback_record()
+    {
+        out_.resize(record_start_);
+    }
+
+    // The encoding of the record started last, as far as it has been appended
+    string_view record_bytes() const
+    {
+        return string_view(out_.data() + record_start_, out_.size() - record_start_);
+    }
+
+    // Append a TLV object to the current record
+    void append_tlv(tlv_type type, const void* pdata, tlv_value::size_type sz)
+    {
+        char* p = append_header(type, sz);
+        memcpy(p, pdata, sz);
+    }
+
+    void append_tlv(const tlv_scalar& scalar)
+    {
+        append_tlv(scalar.type, scalar.bytes, scalar.size);
+    }
+
+    // A string object, with the terminating zero that tlv_value gives its strings
+    void append_string_tlv(string_view str)
+    {
+        char* p = append_header(tlv_type::TLVT_STRING, (tlv_value::size_type)(str.size() + 1));
+        memcpy(p, str.data(), str.size());
+        p[str.size()] = 0;
+    }
+
     template <typename T>
     void write(const T& data)
     {
         if (!pf_)
             throw (runtime_error("No open output file to write"));
         
-        size_t rv = fwrite((void*)&data, sizeof(T), 1, pf_);
+        raw_write_bytes(&data, sizeof(T));
     }
 
     template <typename T>
@@ -84,6 +247,29 @@ public:
         return rv;
     }
 
+    // Push the buffered output to the backing file
+    void flush()
+    {
+        if (!pf_)
+            return;
+        write_out();
+        fflush(pf_);
+    }
+
+    // Push the buffered output all the way to the storage device
+    void sync()
+    {
+        if (!pf_)
+            return;
+        write_out();
+        fflush(pf_);
+#if defined(_WIN32)
+        _commit(_fileno(pf_));
+#else
+        fsync(fileno(pf_));
+#endif
+    }
+
     /**
       Reset the backing file pointer.
       Used for initializing the 'read' operations from the beginning.
@@ -92,6 +278,7 @@ public:
     {
         if (pf_)
         {
+            write_out();
             fseek(pf_, 0, SEEK_SET);
         }
         if (pos)
@@ -99,6 +286,28 @@ public:
     }
 
 private:
+
+    // Size of the backing file as it is on disk
+    uint64_t file_size() const
+    {
+#if defined(_WIN32)
+        struct _stat64 st;
+        return 0 == _fstat64(_fileno(pf_), &st) ? (uint64_t)st.st_size : 0;
+#else
+        struct stat st;
+        return 0 == fstat(fileno(pf_), &st) ? (uint64_t)st.st_size : 0;
+#endif
+    }
+
+    // Read position in the backing file
+    uint64_t position() const
+    {
+#if defined(_WIN32)
+        return (uint64_t)_ftelli64(pf_);
+#else
+        return (uint64_t)ftello(pf_);
+#endif
+    }
     
     void write_tlv_object(const tlv_value& tl)
     {
@@ -117,11 +326,47 @@ private:
         if (!pf_)
             throw (std::runtime_error("No open output file to write"));
 
-        size_t rv = fwrite((void*)pdata, 1, sz, pf_);
+        out_.insert(out_.end(), (const char*)pdata, (const char*)pdata + sz);
+    }
+
+    // Room for an object of 'sz' value bytes at the end of the buffer, returns where its value goes
+    char* append_header(tlv_type type, tlv_value::size_type sz)
+    {
+        if (!pf_)
+            throw (std::runtime_error("No open output file to write"));
+
+        size_t at = out_.size();
+        out_.resize(at + TLV_HEADER_SIZE + sz);
+        char* p = out_.data() + at;
+        p[0] = (char)type;
+        memcpy(p + 1, &sz, sizeof(sz));
+        return p + TLV_HEADER_SIZE;
+    }
+
+    // Hand the buffered output over to the file
+    void write_out()
+    {
+        if (!out_.empty())
+            fwrite(out_.data(), 1, out_.size(), pf_);
+        out_.clear();
+        record_start_ = 0;
+    }
+
+    void close()
+    {
+        if (!pf_)
+            return;
+        write_out();
+        fclose(pf_);
+        pf_ = nullptr;
+        read_end_ = 0;
     }
 
 private:
     FILE* pf_{nullptr};
+    uint64_t read_end_{0};      // Size of a file opened by 'open_existing', 0 if it may still grow
+    vector<char> out_;
+    size_t record_start_{0};
 };
 
 template <>
@@ -132,7 +377,7 @@ void tlv_data_serializer::write<string>(const string& data)
 
     size_t szchar = sizeof(char);
     size_t szstr = data.size();
-    size_t rv = fwrite((void*)data.c_str(), sizeof(char), data.size(), pf_);
+    raw_write_bytes(data.c_str(), data.size());
 }
 
 template <> size_t tlv_data_serializer::read<string>(string* data, size_t sz)
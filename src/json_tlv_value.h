@@ -6,13 +6,121 @@
 #include <stdexcept>
 
 #include <string>
+#include <string_view>
 #include <type_traits>
 #include <stdint.h>
 #include <cstring>
+#include <cmath>
 #include "json_common.h"
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 using namespace std;
 
+/**
+  Width class of an integer: 0, 1, 2 or 3 for the 1, 2, 4 or 8 byte types, chosen without branches
+  from the count of its significant bits. The non-negative values take the unsigned types, the
+  negative ones (given as their two's complement bits) the signed types, which need a sign bit.
+*/
+inline unsigned integer_width_class(uint64_t bits, bool negative)
+{
+	uint64_t magnitude = bits ^ (0 - (uint64_t)negative);
+#if defined(_MSC_VER)
+	unsigned long msb;
+	_BitScanReverse64(&msb, magnitude | 1);
+	unsigned nbits = (unsigned)msb + 1 + negative;
+#else
+	unsigned nbits = 64 - (unsigned)__builtin_clzll(magnitude | 1) + negative;
+#endif
+	return (nbits > 8) + (nbits > 16) + (nbits > 32);
+}
+
+// The width classes of a whole buffer of integers, in a loop the compiler can vectorize
+inline void integer_width_classes(const uint64_t* bits, const uint8_t* negative, size_t count, uint8_t* classes)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint64_t magnitude = bits[i] ^ (0 - (uint64_t)negative[i]);
+		// The largest magnitude of each width, one less for the signed types
+		uint64_t shift = negative[i];
+		classes[i] = (uint8_t)((magnitude > (0xffull >> shift)) + (magnitude > (0xffffull >> shift)) + (magnitude > (0xffffffffull >> shift)));
+	}
+}
+
+/**
+  A scalar value in its TLV encoding, held in place: what the fused encoders fill in instead of
+  allocating a tlv_value.
+*/
+struct tlv_scalar
+{
+	tlv_type		type{tlv_type::TLVT_UNDEFINED};
+	uint32_t		size{0};
+	unsigned char	bytes[8];
+};
+
+/**
+  The narrowest integer encoding of a value, of the given width class (see integer_width_class).
+  'bits' holds the value as uint64_t, or the two's complement bits of a negative value.
+*/
+inline tlv_scalar encode_integer(uint64_t bits, bool negative, unsigned width_class)
+{
+	using tlv_enum_type = std::underlying_type_t<tlv_type>;
+	tlv_enum_type base = negative ? (tlv_enum_type)tlv_type::TLVT_INT8 : (tlv_enum_type)tlv_type::TLVT_UINT8;
+
+	tlv_scalar rv;
+	rv.type = (tlv_type)(base + width_class);
+	rv.size = 1u << width_class;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	memcpy(rv.bytes, (const char*)&bits + sizeof(bits) - rv.size, rv.size);
+#else
+	memcpy(rv.bytes, &bits, rv.size);
+#endif
+	return rv;
+}
+
+/**
+  The smallest lossless encoding of a floating point value. A whole number in the 64-bit range is
+  stored as an integer (e.g. 100.0), unless it is wider than 4 bytes and a float holds it. The
+  others take a float only if it converts back to the very same double (e.g. 0.5, but not 5.28),
+  and a double otherwise. The rule looks at the value alone, so every parse path agrees on it.
+*/
+inline tlv_scalar encode_floating(double value)
+{
+	// The negative zero keeps its sign in a float
+	bool whole = value == std::trunc(value) && !(0 == value && std::signbit(value))
+	             && value >= -9223372036854775808.0 && value < 18446744073709551616.0;
+	uint64_t bits = 0;
+	bool negative = value < 0;
+	unsigned width = 0;
+	if (whole)
+	{
+		bits = negative ? (uint64_t)(int64_t)value : (uint64_t)value;
+		width = integer_width_class(bits, negative);
+		if (width <= 2)
+			return encode_integer(bits, negative, width);
+	}
+
+	tlv_scalar rv;
+	float narrow = (float)value;
+	if ((double)narrow == value)
+	{
+		rv.type = tlv_type::TLVT_FLOAT;
+		rv.size = sizeof(narrow);
+		memcpy(rv.bytes, &narrow, sizeof(narrow));
+		return rv;
+	}
+
+	if (whole)
+		return encode_integer(bits, negative, width);
+
+	rv.type = tlv_type::TLVT_DOUBLE;
+	rv.size = sizeof(value);
+	memcpy(rv.bytes, &value, sizeof(value));
+	return rv;
+}
+
 class tlv_value
 {
 public:
@@ -61,7 +169,7 @@ public:
 		}
 		else if (is_same<T, float>())
 		{
-			init((void*)&value, sizeof(double), tlv_type::TLVT_DOUBLE);
+			init((void*)&value, sizeof(float), tlv_type::TLVT_FLOAT);
 		}
 		else if (is_same<T, double>())
 		{
@@ -91,6 +199,42 @@ public:
 		}
 	}
 	
+	// Build the object from its raw encoding, e.g. as read back from a file
+	tlv_value(tlv_type type, const void* pdata, size_type size)
+	{
+		init(pdata, size, type);
+	}
+
+	tlv_value(const tlv_scalar& scalar)
+	{
+		init(scalar.bytes, scalar.size, scalar.type);
+	}
+
+	// See encode_integer
+	static tlv_value from_integer(uint64_t bits, bool negative, unsigned width_class)
+	{
+		return tlv_value(encode_integer(bits, negative, width_class));
+	}
+
+	// A string taken straight from its bytes, e.g. in the input buffer, without a std::string in between
+	static tlv_value from_string(std::string_view str)
+	{
+		tlv_value rv;
+		rv.init(str.data(), str.size(), str.size() + 1, tlv_type::TLVT_STRING);
+		return rv;
+	}
+
+	static tlv_value from_integer(uint64_t bits, bool negative)
+	{
+		return from_integer(bits, negative, integer_width_class(bits, negative));
+	}
+
+	// See encode_floating
+	static tlv_value from_floating(double value)
+	{
+		return tlv_value(encode_floating(value));
+	}
+
 	tlv_value(const tlv_value& rhs)
 	{
 		if (&rhs == this)
@@ -159,49 +303,72 @@ public:
 
 
 	string as_string_rep() const
+	{
+		return string_rep(type_, pdata_, size_);
+	}
+
+	// The text form of a TLV object given by its parts, e.g. as it lies in an output buffer
+	static string string_rep(tlv_type type, const void* pdata, size_type size)
 	{
 		string rv;
 		char buffer[512]{0};
 
+		// The scalars may lie unaligned, the strings are printed in place
+		union
+		{
+			uint64_t	u;
+			double		d;
+			char		bytes[8];
+		} scalar{0};
+		const void* pvalue = pdata;
+		if (tlv_type::TLVT_STRING != type)
+		{
+			memcpy(scalar.bytes, pdata, size < sizeof(scalar) ? size : sizeof(scalar));
+			pvalue = scalar.bytes;
+		}
+
 		// Format: "type: " <type> <type enum name> "value: " <value>
 
-		switch (type_)
+		switch (type)
 		{
 		case tlv_type::TLVT_INT8:
-			sprintf(buffer, "type: %-4d %-10s size: %-4u value: %-10d", type_, "int8_t", size_, *(int8_t*)pdata_);
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %-10d", type, "int8_t", size, *(int8_t*)pvalue);
 			break;
 		
 		case tlv_type::TLVT_INT16:
-			sprintf(buffer, "type: %-4d %-10s size: %-4u value: %-10d", type_, "int16_t", size_, *(int16_t*)pdata_);
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %-10d", type, "int16_t", size, *(int16_t*)pvalue);
 			break;
 
 		case tlv_type::TLVT_INT32:
-			sprintf(buffer, "type: %-4d %-10s size: %-4u value: %-10d", type_, "int32_t", size_, *(int32_t*)pdata_);
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %-10d", type, "int32_t", size, *(int32_t*)pvalue);
 			break;
 		case tlv_type::TLVT_INT64:
-			sprintf(buffer, "type: %-4d %-10s size: %-4u value: %-10lld", type_, "int64_t", size_, *(int64_t*)pdata_);
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %-10lld", type, "int64_t", size, *(int64_t*)pvalue);
 			break;
 
 		case tlv_type::TLVT_UINT8:
-			sprintf(buffer, "type: %-4d %-10s size: %-4u value: %-10u", type_, "uint8_t", size_, *(uint8_t*)pdata_);
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %-10u", type, "uint8_t", size, *(uint8_t*)pvalue);
 			break;
 
 		case tlv_type::TLVT_UINT16:
-			sprintf(buffer, "type: %-4d %-10s size: %-4u value: %-10u", type_, "uint16_t", size_, *(uint16_t*)pdata_);
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %-10u", type, "uint16_t", size, *(uint16_t*)pvalue);
 			break;
 
 		case tlv_type::TLVT_UINT32:
-			sprintf(buffer, "type: %-4d %-10s size: %-4u value: %-10u", type_, "uint32_t", size_, *(uint32_t*)pdata_);
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %-10u", type, "uint32_t", size, *(uint32_t*)pvalue);
 			break;
 		case tlv_type::TLVT_UINT64:
-			sprintf(buffer, "type: %-4d %-10s size: %-4u value: %-10llu", type_, "uint64_t", size_, *(uint64_t*)pdata_);
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %-10llu", type, "uint64_t", size, *(uint64_t*)pvalue);
 			break;
 
 		case tlv_type::TLVT_DOUBLE:
-			sprintf(buffer, "type: %-4d %-10s size: %-4u value: %f", type_, "double", size_, *(double*)pdata_);
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %f", type, "double", size, *(double*)pvalue);
+			break;
+		case tlv_type::TLVT_FLOAT:
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %g", type, "float", size, *(float*)pvalue);
 			break;
 		case tlv_type::TLVT_STRING:
-			sprintf(buffer, "type: %-4d %-10s size: %-4u value: %-20s", type_, "string", size_, (char*)pdata_);
+			snprintf(buffer, sizeof(buffer), "type: %-4d %-10s size: %-4u value: %-20s", type, "string", size, (char*)pvalue);
 			break;
 		default:
 			rv = "- - - - - - ";
@@ -221,6 +388,16 @@ private:
 		memcpy(pdata_, psrc, size_);
 	}
 
+	// Copy 'used' bytes out of 'size', zeroing the rest (the terminator of a string)
+	void init(const void* psrc, size_t used, size_t size, tlv_type type)
+	{
+		pdata_ = (void*) new char[size];
+		type_ = type;
+		size_ = size;
+		memcpy(pdata_, psrc, used);
+		memset((char*)pdata_ + used, 0, size - used);
+	}
+
 private:
 	void*			pdata_{nullptr};
 	size_type		size_{0};
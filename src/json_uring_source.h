@@ -0,0 +1,389 @@
+#ifndef URING_SOURCE_HEADER
+#define URING_SOURCE_HEADER
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "json_raw_data_source.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define JSON_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#if defined(JSON_HAVE_IO_URING)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/**
+  * Asynchronous input through io_uring, talking to the kernel with the raw system calls.
+  * A set of large registered buffers is kept in flight with fixed-buffer reads at consecutive
+  * file offsets, the completions are handed out to the reader strictly in file order.
+  * 'open' fails if the kernel or the sandbox does not allow io_uring, the caller is expected
+  * to fall back to the buffered source in that case.
+*/
+class raw_uring_source : public raw_data_source
+{
+public:
+    static const int DEFAULT_QUEUE_DEPTH = 4;
+
+    raw_uring_source() = default;
+    ~raw_uring_source() override { close(); }
+
+    int open(const string& fname, size_t chunk_size = raw_stream_source::DEFAULT_CHUNK_SIZE,
+             int queue_depth = DEFAULT_QUEUE_DEPTH, uint64_t start_offset = 0, int open_flags = 0)
+    {
+        close();
+
+        if (-1 == (fd_ = ::open(fname.c_str(), O_RDONLY | open_flags)))
+            return -1;
+
+        if (-1 == setup_ring((unsigned)queue_depth))
+        {
+            close();
+            return -1;
+        }
+
+        // Page aligned buffers, which also satisfies the O_DIRECT alignment rules
+        chunk_size_ = (chunk_size + 4095) & ~(size_t)4095;
+        buffers_.resize(queue_depth);
+        std::vector<iovec> iov(queue_depth);
+        for (int i = 0; i < queue_depth; ++i)
+        {
+            void* p = nullptr;
+            if (posix_memalign(&p, 4096, chunk_size_))
+            {
+                close();
+                return -1;
+            }
+            buffers_[i].data = (char*)p;
+            iov[i].iov_base = p;
+            iov[i].iov_len = chunk_size_;
+        }
+
+        if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS, iov.data(), (unsigned)queue_depth) < 0)
+        {
+            close();
+            return -1;
+        }
+
+        next_offset_ = start_offset;
+        for (int i = 0; i < queue_depth; ++i)
+            submit_read(i);
+        flush_submissions(0);
+        return 0;
+    }
+
+    void close()
+    {
+        // The kernel may still be writing into the buffers, wait for everything in flight
+        if (ring_fd_ != -1)
+        {
+            while (in_flight_ > 0 && reap_completions(true) >= 0)
+                ;
+            ::close(ring_fd_);
+        }
+        ring_fd_ = -1;
+
+        if (sq_ring_ && sq_ring_ != MAP_FAILED)
+            munmap(sq_ring_, sq_ring_size_);
+        if (cq_ring_ && cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+            munmap(cq_ring_, cq_ring_size_);
+        if (sqes_ && (void*)sqes_ != MAP_FAILED)
+            munmap(sqes_, sqes_size_);
+        sq_ring_ = cq_ring_ = nullptr;
+        sqes_ = nullptr;
+
+        for (auto& b : buffers_)
+            free(b.data);
+        buffers_.clear();
+        pending_.clear();
+
+        if (fd_ != -1)
+            ::close(fd_);
+        fd_ = -1;
+
+        current_ = -1;
+        in_flight_ = 0;
+        to_submit_ = 0;
+        next_offset_ = 0;
+        eof_ = false;
+    }
+
+    int64_t next_chunk(string_view& chunk) override
+    {
+        if (-1 == fd_)
+            throw (std::runtime_error("No open input file to read"));
+
+        // The previous chunk has been consumed, put its buffer back in flight
+        if (-1 != current_)
+        {
+            if (!eof_)
+                submit_read(current_);
+            current_ = -1;
+        }
+        flush_submissions(0);
+
+        while (!pending_.empty())
+        {
+            int idx = pending_.front();
+            buffer& buf = buffers_[idx];
+
+            if (!buf.done)
+            {
+                auto t0 = std::chrono::steady_clock::now();
+                while (!buf.done)
+                    if (reap_completions(true) < 0)
+                        throw (std::runtime_error("io_uring_enter failed while waiting for a read"));
+                stats_.wait_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            }
+
+            if (buf.result == -EINTR || buf.result == -EAGAIN)
+            {
+                // Retry the same range in place, it stays at the front of the queue
+                buf.done = false;
+                pending_.pop_front();
+                resubmit_front(idx);
+                continue;
+            }
+
+            if (buf.result < 0)
+                throw (std::runtime_error(string("Error reading the input file: ") + strerror(-buf.result)));
+
+            pending_.pop_front();
+
+            if (0 == buf.result)
+            {
+                eof_ = true;
+                return -1;
+            }
+
+            if ((size_t)buf.result < chunk_size_)
+            {
+                // A short read: the reads queued behind this one started at the wrong offsets.
+                // Drop them and restart right after the bytes we did get.
+                restart_after(buf.offset + (uint64_t)buf.result);
+            }
+
+            current_ = idx;
+            count_chunk((size_t)buf.result);
+            chunk = string_view(buf.data, (size_t)buf.result);
+            return (int64_t)buf.result;
+        }
+
+        return -1;
+    }
+
+    const char* name() const override
+    {
+        return "io_uring";
+    }
+
+private:
+
+    struct buffer
+    {
+        char*       data{nullptr};
+        uint64_t    offset{0};
+        int         result{0};
+        bool        done{false};
+    };
+
+    int setup_ring(unsigned entries)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+
+        ring_fd_ = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd_ < 0)
+        {
+            ring_fd_ = -1;
+            return -1;
+        }
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap)
+            sq_ring_size_ = cq_ring_size_ = (sq_ring_size_ > cq_ring_size_ ? sq_ring_size_ : cq_ring_size_);
+
+        sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        if (MAP_FAILED == sq_ring_)
+            return -1;
+
+        cq_ring_ = single_mmap ? sq_ring_
+                               : mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (MAP_FAILED == cq_ring_)
+            return -1;
+
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = (io_uring_sqe*)mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+        if (MAP_FAILED == (void*)sqes_)
+            return -1;
+
+        char* sq = (char*)sq_ring_;
+        sq_tail_ = (unsigned*)(sq + params.sq_off.tail);
+        sq_mask_ = (unsigned*)(sq + params.sq_off.ring_mask);
+        sq_array_ = (unsigned*)(sq + params.sq_off.array);
+
+        char* cq = (char*)cq_ring_;
+        cq_head_ = (unsigned*)(cq + params.cq_off.head);
+        cq_tail_ = (unsigned*)(cq + params.cq_off.tail);
+        cq_mask_ = (unsigned*)(cq + params.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        return 0;
+    }
+
+    // Queue a read of the next chunk of the file into the given buffer
+    void submit_read(int idx)
+    {
+        buffer& buf = buffers_[idx];
+        buf.offset = next_offset_;
+        next_offset_ += chunk_size_;
+        pending_.push_back(idx);
+        queue_sqe(idx);
+    }
+
+    void resubmit_front(int idx)
+    {
+        pending_.push_front(idx);
+        queue_sqe(idx);
+        flush_submissions(0);
+    }
+
+    void queue_sqe(int idx)
+    {
+        buffer& buf = buffers_[idx];
+        buf.done = false;
+        buf.result = 0;
+
+        unsigned tail = *sq_tail_;
+        unsigned slot = tail & *sq_mask_;
+        io_uring_sqe* sqe = &sqes_[slot];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->fd = fd_;
+        sqe->addr = (uint64_t)(uintptr_t)buf.data;
+        sqe->len = (unsigned)chunk_size_;
+        sqe->off = buf.offset;
+        sqe->buf_index = (uint16_t)idx;
+        sqe->user_data = (uint64_t)idx;
+        sq_array_[slot] = slot;
+
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        ++to_submit_;
+        ++in_flight_;
+    }
+
+    void flush_submissions(unsigned min_complete)
+    {
+        unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+        while (to_submit_ || min_complete)
+        {
+            long rv = syscall(__NR_io_uring_enter, ring_fd_, to_submit_, min_complete, flags, nullptr, 0);
+            if (rv < 0)
+            {
+                if (EINTR == errno || EAGAIN == errno)
+                    continue;
+                throw (std::runtime_error("io_uring_enter failed"));
+            }
+            to_submit_ -= (unsigned)rv < to_submit_ ? (unsigned)rv : to_submit_;
+            min_complete = 0;
+            flags = 0;
+        }
+    }
+
+    // Collect the finished reads, optionally blocking for at least one. Returns the number collected.
+    int reap_completions(bool wait)
+    {
+        unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+        {
+            if (!wait)
+                return 0;
+            long rv;
+            do
+            {
+                rv = syscall(__NR_io_uring_enter, ring_fd_, to_submit_, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            } while (rv < 0 && EINTR == errno);
+            if (rv < 0)
+                return -1;
+            to_submit_ = 0;
+        }
+
+        int count = 0;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head, ++count)
+        {
+            const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+            buffer& buf = buffers_[(size_t)cqe.user_data];
+            buf.result = cqe.res;
+            buf.done = true;
+            --in_flight_;
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    void restart_after(uint64_t offset)
+    {
+        std::deque<int> stale;
+        stale.swap(pending_);
+
+        for (int idx : stale)
+            while (!buffers_[idx].done)
+                if (reap_completions(true) < 0)
+                    throw (std::runtime_error("io_uring_enter failed while waiting for a read"));
+
+        next_offset_ = offset;
+        for (int idx : stale)
+            submit_read(idx);
+        flush_submissions(0);
+    }
+
+private:
+    int                 fd_{-1};
+    int                 ring_fd_{-1};
+    size_t              chunk_size_{0};
+
+    void*               sq_ring_{nullptr};
+    void*               cq_ring_{nullptr};
+    io_uring_sqe*       sqes_{nullptr};
+    size_t              sq_ring_size_{0};
+    size_t              cq_ring_size_{0};
+    size_t              sqes_size_{0};
+
+    unsigned*           sq_tail_{nullptr};
+    unsigned*           sq_mask_{nullptr};
+    unsigned*           sq_array_{nullptr};
+    unsigned*           cq_head_{nullptr};
+    unsigned*           cq_tail_{nullptr};
+    unsigned*           cq_mask_{nullptr};
+    io_uring_cqe*       cqes_{nullptr};
+
+    std::vector<buffer> buffers_;
+    std::deque<int>     pending_;       // Buffers in flight or completed, in file order
+    int                 current_{-1};   // Buffer handed out to the reader
+    unsigned            to_submit_{0};
+    int                 in_flight_{0};
+    uint64_t            next_offset_{0};
+    bool                eof_{false};
+};
+
+#endif // JSON_HAVE_IO_URING
+
+#endif // URING_SOURCE_HEADER
@@ -0,0 +1,285 @@
+#ifndef JSON_UTF8_HEADER
+#define JSON_UTF8_HEADER
+
+#include <stdint.h>
+#include <string.h>
+#include <string_view>
+#include "json_simd.h"
+
+/**
+  * UTF-8 validation of the input records, ahead of the field extraction.
+  * Most records are plain ASCII, which a single OR-reduction pass over the record tells; only the
+  * others are validated, on x86 with the lookup table algorithm of Keiser and Lemire (as used by
+  * simdjson) on AVX2, or on SSSE3 as the fallback, and elsewhere byte by byte. All of them reject
+  * the overlong forms, the UTF-16 surrogates, the code points above U+10FFFF and the truncated
+  * sequences, exactly as the JSON parser does.
+*/
+
+inline bool utf8_is_ascii_scalar(const char* p, size_t len)
+{
+    uint64_t acc = 0;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t w;
+        memcpy(&w, p + i, sizeof(w));
+        acc |= w;
+    }
+    for (; i < len; ++i)
+        acc |= (unsigned char)p[i];
+    return 0 == (acc & 0x8080808080808080ull);
+}
+
+inline bool utf8_validate_scalar(const char* p, size_t len)
+{
+    const unsigned char* s = (const unsigned char*)p;
+    const unsigned char* end = s + len;
+    while (s != end)
+    {
+        unsigned char c = *s;
+        if (c < 0x80)
+        {
+            ++s;
+            continue;
+        }
+
+        // The length of the sequence and the range of its second byte, which rules out the
+        // overlong forms, the surrogates and the code points above U+10FFFF
+        size_t n;
+        unsigned char lo = 0x80, hi = 0xbf;
+        if (c >= 0xc2 && c <= 0xdf)
+            n = 2;
+        else if (c >= 0xe0 && c <= 0xef)
+        {
+            n = 3;
+            if (0xe0 == c)
+                lo = 0xa0;
+            else if (0xed == c)
+                hi = 0x9f;
+        }
+        else if (c >= 0xf0 && c <= 0xf4)
+        {
+            n = 4;
+            if (0xf0 == c)
+                lo = 0x90;
+            else if (0xf4 == c)
+                hi = 0x8f;
+        }
+        else
+            return false;
+
+        if ((size_t)(end - s) < n || s[1] < lo || s[1] > hi)
+            return false;
+        for (size_t i = 2; i < n; ++i)
+            if ((s[i] & 0xc0) != 0x80)
+                return false;
+        s += n;
+    }
+    return true;
+}
+
+inline bool utf8_validate_records_scalar(const char* p, size_t len)
+{
+    return utf8_is_ascii_scalar(p, len) || utf8_validate_scalar(p, len);
+}
+
+#if defined(JSON_SIMD_X86)
+
+// The error classes of the lookup tables, a pair of bytes is invalid if all three tables agree on a class
+namespace utf8_lookup
+{
+    const uint8_t TOO_SHORT      = 1 << 0;  // A lead byte not followed by a continuation byte
+    const uint8_t TOO_LONG       = 1 << 1;  // An ASCII byte followed by a continuation byte
+    const uint8_t OVERLONG_3     = 1 << 2;  // 11100000 100_____
+    const uint8_t TOO_LARGE      = 1 << 3;  // 11110100 1001____ and above
+    const uint8_t SURROGATE      = 1 << 4;  // 11101101 101_____
+    const uint8_t OVERLONG_2     = 1 << 5;  // 1100000_ 10______
+    const uint8_t TOO_LARGE_1000 = 1 << 6;  // 11110101 1000____ and above
+    const uint8_t OVERLONG_4     = 1 << 6;  // 11110000 1000____
+    const uint8_t TWO_CONTS      = 1 << 7;  // Two continuation bytes, valid only within a 3 or 4 byte sequence
+    const uint8_t CARRY          = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+    // By the high nibble of the first byte of the pair
+    alignas(16) const uint8_t byte_1_high[16] = {
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+    };
+
+    // By the low nibble of the first byte
+    alignas(16) const uint8_t byte_1_low[16] = {
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000
+    };
+
+    // By the high nibble of the second byte
+    alignas(16) const uint8_t byte_2_high[16] = {
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+    };
+}
+
+__attribute__((target("sse2")))
+inline bool utf8_is_ascii_sse2(const char* p, size_t len)
+{
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+        acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(p + i)));
+    return 0 == _mm_movemask_epi8(acc) && utf8_is_ascii_scalar(p + i, len - i);
+}
+
+/**
+  The errors of a 16 byte block: the three table lookups classify each byte together with the one
+  before it, the lengths of the 3 and 4 byte sequences are checked against the bytes 2 and 3 back.
+*/
+__attribute__((target("ssse3")))
+inline __m128i utf8_check_block_ssse3(__m128i input, __m128i prev_input)
+{
+    using namespace utf8_lookup;
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    __m128i prev1 = _mm_alignr_epi8(input, prev_input, 16 - 1);
+    __m128i b1h = _mm_shuffle_epi8(_mm_load_si128((const __m128i*)byte_1_high), _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    __m128i b1l = _mm_shuffle_epi8(_mm_load_si128((const __m128i*)byte_1_low), _mm_and_si128(prev1, nibble));
+    __m128i b2h = _mm_shuffle_epi8(_mm_load_si128((const __m128i*)byte_2_high), _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+    __m128i special = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+
+    // Only 111_____ two bytes back or 1111____ three bytes back leave the high bit set
+    __m128i prev2 = _mm_alignr_epi8(input, prev_input, 16 - 2);
+    __m128i prev3 = _mm_alignr_epi8(input, prev_input, 16 - 3);
+    __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80))),
+                                  _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80))));
+    __m128i must23_80 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+    return _mm_xor_si128(must23_80, special);
+}
+
+__attribute__((target("ssse3")))
+inline bool utf8_validate_records_ssse3(const char* p, size_t len)
+{
+    if (utf8_is_ascii_sse2(p, len))
+        return true;
+
+    __m128i error = _mm_setzero_si128();
+    __m128i prev = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i input = _mm_loadu_si128((const __m128i*)(p + i));
+        error = _mm_or_si128(error, utf8_check_block_ssse3(input, prev));
+        prev = input;
+    }
+
+    // The tail padded with ASCII zeros, at least one of which follows the last byte and shows up a
+    // sequence cut short by the end
+    char tail[16] = {0};
+    memcpy(tail, p + i, len - i);
+    error = _mm_or_si128(error, utf8_check_block_ssse3(_mm_loadu_si128((const __m128i*)tail), prev));
+
+    return 0xffff == _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128()));
+}
+
+// The bytes N positions back: the lanes of 'input' shifted across the lanes one lane earlier
+template <int N>
+__attribute__((target("avx2")))
+inline __m256i utf8_prev_avx2(__m256i input, __m256i prev_input)
+{
+    __m256i earlier = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    return _mm256_alignr_epi8(input, earlier, 16 - N);
+}
+
+__attribute__((target("avx2")))
+inline __m256i utf8_check_block_avx2(__m256i input, __m256i prev_input)
+{
+    using namespace utf8_lookup;
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i t1h = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)byte_1_high));
+    const __m256i t1l = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)byte_1_low));
+    const __m256i t2h = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)byte_2_high));
+
+    __m256i prev1 = utf8_prev_avx2<1>(input, prev_input);
+    __m256i b1h = _mm256_shuffle_epi8(t1h, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i b1l = _mm256_shuffle_epi8(t1l, _mm256_and_si256(prev1, nibble));
+    __m256i b2h = _mm256_shuffle_epi8(t2h, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+
+    __m256i prev2 = utf8_prev_avx2<2>(input, prev_input);
+    __m256i prev3 = utf8_prev_avx2<3>(input, prev_input);
+    __m256i must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 0x80))),
+                                     _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 0x80))));
+    __m256i must23_80 = _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must23_80, special);
+}
+
+__attribute__((target("avx2")))
+inline bool utf8_validate_records_avx2(const char* p, size_t len)
+{
+    // The ASCII check first, a pass of loads and ORs
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+        acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(p + i)));
+    if (0 == _mm256_movemask_epi8(acc) && utf8_is_ascii_scalar(p + i, len - i))
+        return true;
+
+    __m256i error = _mm256_setzero_si256();
+    __m256i prev = _mm256_setzero_si256();
+    for (i = 0; i + 32 <= len; i += 32)
+    {
+        __m256i input = _mm256_loadu_si256((const __m256i*)(p + i));
+        error = _mm256_or_si256(error, utf8_check_block_avx2(input, prev));
+        prev = input;
+    }
+
+    char tail[32] = {0};
+    memcpy(tail, p + i, len - i);
+    error = _mm256_or_si256(error, utf8_check_block_avx2(_mm256_loadu_si256((const __m256i*)tail), prev));
+
+    return _mm256_testz_si256(error, error);
+}
+
+#endif // JSON_SIMD_X86
+
+using utf8_validate_fn = bool (*)(const char*, size_t);
+
+inline utf8_validate_fn select_utf8_validate()
+{
+#if defined(JSON_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return utf8_validate_records_avx2;
+    if (__builtin_cpu_supports("ssse3"))
+        return utf8_validate_records_ssse3;
+#endif
+    return utf8_validate_records_scalar;
+}
+
+// The record is valid UTF-8
+inline bool utf8_validate(std::string_view s)
+{
+    static const utf8_validate_fn validate = select_utf8_validate();
+    return validate(s.data(), s.size());
+}
+
+#endif // JSON_UTF8_HEADER
@@ -0,0 +1,263 @@
+/**
+  * Self-check of dictionary_image: the lookups of an image written from a key_dictionary, and the
+  * refusal of the corrupted images, with and without the checksum.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "json_dictionary_image.h"
+#include "self_check.h"
+
+using std::string;
+using std::string_view;
+using std::vector;
+
+static vector<char> read_file(const string& fname)
+{
+    vector<char> bytes;
+    FILE* pf = fopen(fname.c_str(), "rb");
+    if (!pf)
+        return bytes;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), pf)) > 0)
+        bytes.insert(bytes.end(), chunk, chunk + n);
+    fclose(pf);
+    return bytes;
+}
+
+static void write_file(const string& fname, const vector<char>& bytes)
+{
+    FILE* pf = fopen(fname.c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size(), pf);
+    fclose(pf);
+}
+
+template <typename T>
+static T get(const vector<char>& bytes, size_t offset)
+{
+    T v;
+    memcpy(&v, bytes.data() + offset, sizeof(v));
+    return v;
+}
+
+template <typename T>
+static void put(vector<char>& bytes, size_t offset, T v)
+{
+    memcpy(bytes.data() + offset, &v, sizeof(v));
+}
+
+// Recompute the checksum of a patched image, so that only the structural checks can refuse it
+static void reseal(vector<char>& bytes)
+{
+    uint32_t sum = crc32c(string_view(bytes.data() + sizeof(dictionary_image_header), bytes.size() - sizeof(dictionary_image_header)));
+    put(bytes, offsetof(dictionary_image_header, checksum), sum);
+}
+
+static bool opens(const string& fname, const vector<char>& bytes, bool verify)
+{
+    write_file(fname, bytes);
+    dictionary_image image;
+    return 0 == image.open(fname, verify);
+}
+
+static void check_lookups(const string& fname)
+{
+    key_dictionary keys;
+    vector<string> names;
+    for (int i = 1; i <= 1000; ++i)
+    {
+        names.push_back("key_" + std::to_string(i * 7919 % 100003));
+        // Every third ID is left unused
+        keys.assign(names.back(), (dictionary_value_type)(i + i / 2));
+    }
+    names.push_back("");
+    keys.assign(names.back(), 3000);
+
+    CHECK(0 == dictionary_image::write(fname, keys));
+
+    dictionary_image image;
+    CHECK(0 == image.open(fname));
+    CHECK(image.is_open());
+    CHECK(keys.size() == image.size());
+    CHECK(3000 == image.last_id());
+
+    for (const string& name : names)
+    {
+        dictionary_value_type expected = 0, id = -1;
+        CHECK(keys.find(name, expected));
+        CHECK(image.find(name, id));
+        CHECK(expected == id);
+
+        string_view back;
+        CHECK(image.key(id, back));
+        CHECK(back == name);
+    }
+
+    dictionary_value_type id;
+    string_view key;
+    CHECK(!image.find("key_missing", id));
+    CHECK(!image.find("key_", id));
+    CHECK(!image.key(0, key));
+    CHECK(!image.key(2, key));
+    CHECK(!image.key(-1, key));
+    CHECK(!image.key(3001, key));
+
+    size_t visited = 0;
+    CHECK(0 == image.for_each([&](string_view k, dictionary_value_type i) { dictionary_value_type e; ++visited; CHECK(keys.find(k, e) && e == i); }));
+    CHECK(keys.size() == visited);
+
+    // An empty dictionary is a valid image too
+    key_dictionary none;
+    CHECK(0 == dictionary_image::write(fname, none));
+    CHECK(0 == image.open(fname));
+    CHECK(0 == image.size());
+    CHECK(!image.find("a", id));
+
+    // The IDs are not negative
+    none.assign("neg", -2);
+    CHECK(-1 == dictionary_image::write(fname, none));
+}
+
+static void check_corruption(const string& fname)
+{
+    key_dictionary keys;
+    keys.assign("alpha", 1);
+    keys.assign("beta", 2);
+    keys.assign("gamma", 3);
+    CHECK(0 == dictionary_image::write(fname, keys));
+    const vector<char> good = read_file(fname);
+    CHECK(opens(fname, good, true));
+
+    const size_t ids_at = (size_t)get<uint64_t>(good, offsetof(dictionary_image_header, id_table_offset));
+    const size_t slots_at = (size_t)get<uint64_t>(good, offsetof(dictionary_image_header, slot_table_offset));
+    const size_t keys_at = (size_t)get<uint64_t>(good, offsetof(dictionary_image_header, keys_offset));
+    const uint32_t slot_count = get<uint32_t>(good, offsetof(dictionary_image_header, slot_count));
+    // The records are sorted by the key: alpha, beta, gamma, each of 8 + 6 -> 16 bytes ("alpha")
+    const size_t second_at = keys_at + 16;
+
+    // Cut short, the size no longer matches the header
+    vector<char> bad(good.begin(), good.end() - 4);
+    CHECK(!opens(fname, bad, false));
+    bad.assign(good.begin(), good.begin() + 10);
+    CHECK(!opens(fname, bad, false));
+
+    // Not an image or of another version
+    bad = good;
+    bad[0] = 'X';
+    CHECK(!opens(fname, bad, false));
+    bad = good;
+    put<uint32_t>(bad, offsetof(dictionary_image_header, version), 99);
+    CHECK(!opens(fname, bad, false));
+
+    // A slot count other than a power of two, or too small for the keys
+    bad = good;
+    put<uint32_t>(bad, offsetof(dictionary_image_header, slot_count), 12);
+    CHECK(!opens(fname, bad, false));
+    bad = good;
+    put<uint32_t>(bad, offsetof(dictionary_image_header, key_count), slot_count);
+    CHECK(!opens(fname, bad, false));
+
+    // Sections beyond the end of the file, and more IDs than dictionary_value_type holds
+    bad = good;
+    put<uint64_t>(bad, offsetof(dictionary_image_header, slot_table_offset), good.size());
+    CHECK(!opens(fname, bad, false));
+    bad = good;
+    put<uint32_t>(bad, offsetof(dictionary_image_header, id_count), 1u << 20);
+    CHECK(!opens(fname, bad, false));
+    bad = good;
+    put<uint32_t>(bad, offsetof(dictionary_image_header, id_count), 40000);
+    put<uint64_t>(bad, offsetof(dictionary_image_header, id_table_offset), sizeof(dictionary_image_header));
+    CHECK(!opens(fname, bad, false));
+
+    // A flipped key byte fails the checksum, and is otherwise only a key that is not found
+    bad = good;
+    bad[keys_at + 8] ^= 0x20;
+    CHECK(!opens(fname, bad, true));
+    {
+        write_file(fname, bad);
+        dictionary_image image;
+        dictionary_value_type id;
+        CHECK(0 == image.open(fname, false));
+        CHECK(!image.find("alpha", id));
+        CHECK(image.find("beta", id) && 2 == id);
+    }
+
+    // The key size of a record running past the end of the file
+    bad = good;
+    put<uint32_t>(bad, second_at + 4, 0xffffffffu);
+    reseal(bad);
+    CHECK(!opens(fname, bad, true));
+    {
+        write_file(fname, bad);
+        dictionary_image image;
+        dictionary_value_type id;
+        string_view key;
+        CHECK(0 == image.open(fname, false));
+        CHECK(!image.find("beta", id));
+        CHECK(!image.key(2, key));
+        CHECK(image.key(1, key) && key == "alpha");
+        CHECK(-1 == image.for_each([](string_view, dictionary_value_type) {}));
+    }
+
+    // An ID table entry pointing ahead of the records, or past the end of the file
+    bad = good;
+    put<uint32_t>(bad, ids_at + 1 * sizeof(uint32_t), 8);
+    put<uint32_t>(bad, ids_at + 2 * sizeof(uint32_t), (uint32_t)good.size());
+    reseal(bad);
+    CHECK(!opens(fname, bad, true));
+    {
+        write_file(fname, bad);
+        dictionary_image image;
+        string_view key;
+        CHECK(0 == image.open(fname, false));
+        CHECK(!image.key(1, key));
+        CHECK(!image.key(2, key));
+        CHECK(image.key(3, key) && key == "gamma");
+    }
+
+    // Two keys sharing an ID
+    bad = good;
+    put<int32_t>(bad, second_at, 1);
+    reseal(bad);
+    CHECK(!opens(fname, bad, true));
+
+    // A key that the hash table does not lead to
+    bad = good;
+    for (uint32_t i = 0; i < slot_count; ++i)
+        put<uint32_t>(bad, slots_at + i * 8, 0);
+    reseal(bad);
+    CHECK(!opens(fname, bad, true));
+
+    // Every slot taken: a miss has to stop after a round of the table
+    bad = good;
+    for (uint32_t i = 0; i < slot_count; ++i)
+    {
+        if (!get<uint32_t>(bad, slots_at + i * 8))
+        {
+            put<uint32_t>(bad, slots_at + i * 8, 0x12345678u);
+            put<uint32_t>(bad, slots_at + i * 8 + 4, (uint32_t)keys_at);
+        }
+    }
+    reseal(bad);
+    {
+        write_file(fname, bad);
+        dictionary_image image;
+        dictionary_value_type id;
+        CHECK(0 == image.open(fname, true));
+        CHECK(!image.find("delta", id));
+        CHECK(image.find("gamma", id) && 3 == id);
+    }
+}
+
+int main(int argc, const char* argv[])
+{
+    string fname = string(argv[0]) + ".img";
+    check_lookups(fname);
+    check_corruption(fname);
+    remove(fname.c_str());
+    return SELF_CHECK_RESULT("dictionary_image_check");
+}
@@ -0,0 +1,220 @@
+/**
+  * Self-check of the Robin Hood key_dictionary against a std::map: growth across the 7/8 load
+  * thresholds, keys sharing their whole CRC32C hash or only their home slots, and erase_if and
+  * reinsertion in the middle of the probe sequences.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "json_key_dictionary.h"
+#include "self_check.h"
+
+using std::map;
+using std::string;
+using std::string_view;
+using std::vector;
+
+using reference = map<string, dictionary_value_type>;
+
+// Everything the dictionary holds is in the reference and the other way round
+static bool same_contents(const key_dictionary& keys, const reference& ref)
+{
+    if (keys.size() != ref.size() || keys.empty() != ref.empty())
+        return false;
+
+    vector<key_dictionary::entry> entries = keys.sorted_entries();
+    if (entries.size() != ref.size())
+        return false;
+    size_t i = 0;
+    for (auto& [key, id] : ref)
+    {
+        dictionary_value_type found = 0;
+        if (entries[i].first != key || entries[i].second != id || !keys.find(key, found) || found != id)
+            return false;
+        ++i;
+    }
+    return true;
+}
+
+static string key_name(int i)
+{
+    return "key_" + std::to_string(i);
+}
+
+static void check_growth()
+{
+    key_dictionary keys;
+    reference ref;
+    dictionary_value_type id;
+
+    CHECK(!keys.find("", id));
+    CHECK(same_contents(keys, ref));
+
+    // Checked in full around every doubling of the table
+    for (int i = 0; i < 20000; ++i)
+    {
+        string key = key_name(i);
+        auto [value, added] = keys.try_emplace(key, (dictionary_value_type)(i & 0x7fff));
+        CHECK(added && value == (dictionary_value_type)(i & 0x7fff));
+        ref[key] = (dictionary_value_type)(i & 0x7fff);
+
+        // A second emplace finds the key and keeps its ID
+        auto [again, added_again] = keys.try_emplace(key, -1);
+        CHECK(!added_again && again == value);
+
+        size_t n = (size_t)i + 1;
+        bool threshold = false;
+        for (size_t capacity = key_dictionary::INITIAL_CAPACITY; capacity <= 65536; capacity *= 2)
+            threshold |= n + 1 >= capacity * 7 / 8 && n <= capacity * 7 / 8 + 1;
+        if (threshold || i < 200)
+            CHECK(same_contents(keys, ref));
+    }
+    CHECK(same_contents(keys, ref));
+    CHECK(!keys.find("key_20000", id));
+    CHECK(!keys.find("key_", id));
+
+    // The empty key is a key like the others
+    CHECK(keys.try_emplace("", 7).second);
+    ref[""] = 7;
+    CHECK(keys.find("", id) && 7 == id);
+
+    // assign changes the ID of a present key, and adds a new one
+    keys.assign("key_5", 1234);
+    keys.assign("new_key", 4321);
+    ref["key_5"] = 1234;
+    ref["new_key"] = 4321;
+    CHECK(same_contents(keys, ref));
+
+    // reserve keeps the contents
+    keys.reserve(200000);
+    CHECK(same_contents(keys, ref));
+
+    keys.clear();
+    ref.clear();
+    CHECK(same_contents(keys, ref));
+    CHECK(keys.try_emplace("after_clear", 1).second);
+    CHECK(keys.find("after_clear", id) && 1 == id);
+}
+
+// Keys of the same CRC32C, found by the birthday bound among a few hundred thousand candidates
+static vector<std::pair<string, string>> find_hash_collisions()
+{
+    vector<std::pair<string, string>> pairs;
+    std::unordered_map<uint32_t, string> seen;
+    for (int i = 0; i < 400000 && pairs.size() < 16; ++i)
+    {
+        string key = "c" + std::to_string(i * 2654435761u);
+        auto [it, added] = seen.emplace(crc32c(key), key);
+        if (!added)
+            pairs.emplace_back(it->second, key);
+    }
+    return pairs;
+}
+
+static void check_collisions()
+{
+    vector<std::pair<string, string>> pairs = find_hash_collisions();
+    CHECK(pairs.size() >= 2);
+    printf("keys sharing their hash: %zu pairs\n", pairs.size());
+
+    key_dictionary keys;
+    reference ref;
+    dictionary_value_type next = 1;
+
+    // The pairs among enough other keys for the table to grow a few times
+    for (auto& [a, b] : pairs)
+    {
+        CHECK(keys.try_emplace(a, next).second);
+        ref[a] = next++;
+        dictionary_value_type id;
+        CHECK(!keys.find(b, id));
+        CHECK(keys.try_emplace(b, next).second);
+        ref[b] = next++;
+        for (int i = 0; i < 50; ++i, ++next)
+        {
+            keys.try_emplace(key_name(next), next);
+            ref[key_name(next)] = next;
+        }
+    }
+    CHECK(same_contents(keys, ref));
+
+    // Removing one key of each pair leaves the other reachable, though it sits past the removed one
+    keys.erase_if([&pairs](string_view key, dictionary_value_type) {
+        for (auto& p : pairs)
+            if (key == p.first)
+                return true;
+        return false;
+    });
+    for (auto& p : pairs)
+        ref.erase(p.first);
+    CHECK(same_contents(keys, ref));
+
+    for (auto& p : pairs)
+    {
+        dictionary_value_type id;
+        CHECK(!keys.find(p.first, id));
+        CHECK(keys.find(p.second, id) && ref[p.second] == id);
+        CHECK(keys.try_emplace(p.first, 999).second);
+        ref[p.first] = 999;
+    }
+    CHECK(same_contents(keys, ref));
+}
+
+// Long probe sequences: a small table kept near its load limit, keys removed and added back at random
+static void check_erase_and_reinsert()
+{
+    key_dictionary keys;
+    reference ref;
+    uint64_t state = 0x853c49e6748fea9bull;
+    auto next = [&state]() { state ^= state << 13; state ^= state >> 7; state ^= state << 17; return state; };
+
+    for (int round = 0; round < 300; ++round)
+    {
+        // Up to just below the first growth, then past it on some rounds
+        size_t target = 40 + next() % 30;
+        while (ref.size() < target)
+        {
+            string key = key_name((int)(next() % 500));
+            dictionary_value_type value = (dictionary_value_type)(next() % 30000);
+            auto [got, added] = keys.try_emplace(key, value);
+            auto ins = ref.emplace(key, value);
+            CHECK(added == ins.second);
+            CHECK(got == ins.first->second);
+        }
+        CHECK(same_contents(keys, ref));
+
+        // Remove by the key, by the ID, or everything
+        unsigned mod = 2 + (unsigned)(next() % 5);
+        bool by_value = next() % 2;
+        bool all = 0 == next() % 50;
+        auto pred = [&](string_view key, dictionary_value_type value) {
+            return all || (by_value ? 0 == (unsigned)value % mod : 0 == key.size() % mod);
+        };
+        keys.erase_if(pred);
+        for (auto it = ref.begin(); it != ref.end(); )
+            it = pred(it->first, it->second) ? ref.erase(it) : std::next(it);
+        CHECK(same_contents(keys, ref));
+
+        // A copy is independent of the original
+        if (0 == round % 37)
+        {
+            key_dictionary copy = keys;
+            copy.try_emplace("only_in_copy", 1);
+            dictionary_value_type id;
+            CHECK(!keys.find("only_in_copy", id));
+            CHECK(same_contents(keys, ref));
+        }
+    }
+}
+
+int main()
+{
+    check_growth();
+    check_collisions();
+    check_erase_and_reinsert();
+    return SELF_CHECK_RESULT("key_dictionary_check");
+}
@@ -0,0 +1,32 @@
+#ifndef SELF_CHECK_HEADER
+#define SELF_CHECK_HEADER
+
+#include <stdio.h>
+
+/**
+  * The few helpers of the self-check programs under tests/, built and run by 'make check'.
+  * A failed check is reported with its location and the program goes on, returning the number
+  * of the failures from main via SELF_CHECK_RESULT.
+*/
+
+inline int& self_check_failures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                                             \
+    do                                                                                          \
+    {                                                                                           \
+        if (!(cond))                                                                            \
+        {                                                                                       \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                     \
+            ++self_check_failures();                                                            \
+        }                                                                                       \
+    } while (0)
+
+#define SELF_CHECK_RESULT(name)                                                                 \
+    (printf("%s: %s (%d failed checks)\n", name, self_check_failures() ? "FAILED" : "passed",   \
+            self_check_failures()), self_check_failures() ? 1 : 0)
+
+#endif // SELF_CHECK_HEADER
@@ -0,0 +1,205 @@
+/**
+  * Self-check of structural_indexer and its block classifiers against a byte-at-a-time reference,
+  * on the quotes and the backslash runs around the 64 byte block boundaries and on random lines.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "json_structural_index.h"
+#include "self_check.h"
+
+using std::string;
+using std::vector;
+
+struct reference_index
+{
+    vector<uint32_t>    positions;
+    bool                complete{true};     // The line does not end within a string
+    bool                escapes{false};
+    bool                controls{false};
+};
+
+static bool is_op(char c)
+{
+    return '{' == c || '}' == c || '[' == c || ']' == c || ':' == c || ',' == c;
+}
+
+static bool is_ws(char c)
+{
+    return ' ' == c || '\t' == c || '\r' == c || '\n' == c;
+}
+
+// The structural positions as the indexer defines them, found one byte at a time
+static reference_index index_scalar(const string& line)
+{
+    reference_index ref;
+    bool in_string = false, escaped = false, prev_scalar = false;
+    for (size_t i = 0; i < line.size(); ++i)
+    {
+        char c = line[i];
+        if (in_string)
+        {
+            if (escaped)
+                escaped = false;
+            else if ('\\' == c)
+                escaped = true;
+            else if ('"' == c)
+            {
+                in_string = false;
+                ref.positions.push_back((uint32_t)i);
+                continue;
+            }
+            if ('\\' == c)
+                ref.escapes = true;
+            if ((unsigned char)c < 0x20)
+                ref.controls = true;
+            continue;
+        }
+
+        bool scalar = false;
+        if ('"' == c)
+        {
+            // A backslash outside the strings still escapes the quote after it
+            if (escaped)
+                scalar = true;
+            else
+            {
+                in_string = true;
+                ref.positions.push_back((uint32_t)i);
+            }
+        }
+        else if (is_op(c))
+            ref.positions.push_back((uint32_t)i);
+        else if (!is_ws(c))
+        {
+            scalar = true;
+            if (!prev_scalar)
+                ref.positions.push_back((uint32_t)i);
+        }
+        escaped = !escaped && '\\' == c;
+        prev_scalar = scalar;
+    }
+    ref.complete = !in_string;
+    return ref;
+}
+
+static int checked_lines = 0;
+
+static void check_line(structural_indexer& indexer, const string& line)
+{
+    vector<uint32_t> positions;
+    reference_index ref = index_scalar(line);
+    int count = indexer.index(line, positions);
+    ++checked_lines;
+
+    if (!ref.complete)
+    {
+        CHECK(-1 == count);
+        return;
+    }
+
+    bool same = count == (int)ref.positions.size() && indexer.string_escapes() == ref.escapes && indexer.string_controls() == ref.controls;
+    for (int i = 0; same && i < count; ++i)
+        same = positions[i] == ref.positions[i];
+    CHECK(same);
+    if (!same)
+        printf("  line of %zu bytes: '%s'\n", line.size(), line.c_str());
+}
+
+// Every classifier the CPU runs gives the bitmaps of the scalar one
+static void check_classifiers()
+{
+    vector<classify_blocks_fn> kernels;
+#if defined(JSON_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back(classify_blocks_sse2);
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(classify_blocks_avx2);
+#endif
+
+    // All the byte values, then the interesting ones at every position
+    vector<char> input(64 * 8);
+    for (size_t i = 0; i < 256; ++i)
+        input[i] = (char)i;
+    const char specials[] = "\"\\{}[]:, \t\r\n\x01\x1f\x7f\x80\xff;{|";
+    for (size_t i = 256; i < input.size(); ++i)
+        input[i] = specials[(i * 7) % (sizeof(specials) - 1)];
+
+    const size_t count = input.size() / 64;
+    vector<structural_block> expected(count), got(count);
+    classify_blocks_scalar(input.data(), count, expected.data());
+    for (classify_blocks_fn kernel : kernels)
+    {
+        kernel(input.data(), count, got.data());
+        for (size_t k = 0; k < count; ++k)
+        {
+            CHECK(expected[k].quote == got[k].quote);
+            CHECK(expected[k].backslash == got[k].backslash);
+            CHECK(expected[k].op == got[k].op);
+            CHECK(expected[k].ws == got[k].ws);
+            CHECK(expected[k].control == got[k].control);
+        }
+    }
+    printf("classifiers checked: %zu besides the scalar one\n", kernels.size());
+}
+
+// A quote and runs of backslashes put across the block boundaries, inside and outside the strings
+static void check_block_boundaries(structural_indexer& indexer)
+{
+    for (size_t pad = 0; pad < 140; ++pad)
+    {
+        for (size_t run = 0; run < 70; run += (run < 8 ? 1 : 7))
+        {
+            string backslashes(run, '\\');
+            string filler(pad, 'a');
+
+            // The run ends right before a quote, which closes the string for an even run only
+            check_line(indexer, "{\"k\":\"" + filler + backslashes + "\"}");
+            check_line(indexer, "{\"k\":\"" + filler + backslashes + "\",\"v\":1}");
+            check_line(indexer, "{\"" + filler + "\":\"" + backslashes + backslashes + "\"}");
+            check_line(indexer, "{\"k\":" + filler + "," + backslashes + "\"x\"}");
+
+            // Quotes landing on the last and the first byte of a block
+            string spaces(pad, ' ');
+            check_line(indexer, spaces + "\"" + backslashes + "\"" + spaces + "\"\"");
+            check_line(indexer, "[" + spaces + "123" + spaces + ",true" + backslashes + "]");
+        }
+    }
+
+    // Controls and escapes inside and outside the strings
+    check_line(indexer, "{\"a\":\"x\ty\"}");
+    check_line(indexer, "{\"a\":\"x\\ny\"}");
+    check_line(indexer, "{\"a\"\t:\t\"xy\"}\r");
+    check_line(indexer, "{\"a\":\"x");
+    check_line(indexer, "");
+    check_line(indexer, "\"");
+    check_line(indexer, "\\\"");
+}
+
+static void check_random(structural_indexer& indexer)
+{
+    const char alphabet[] = "\"\"\"\\\\\\{}[]:, \tab1-.e\x01\x80";
+    uint64_t state = 0x9e3779b97f4a7c15ull;
+    auto next = [&state]() { state ^= state << 13; state ^= state >> 7; state ^= state << 17; return state; };
+
+    for (int n = 0; n < 20000; ++n)
+    {
+        string line(next() % 300, ' ');
+        for (char& c : line)
+            c = alphabet[next() % (sizeof(alphabet) - 1)];
+        check_line(indexer, line);
+    }
+}
+
+int main()
+{
+    structural_indexer indexer;
+    check_classifiers();
+    check_block_boundaries(indexer);
+    check_random(indexer);
+    printf("lines checked: %d\n", checked_lines);
+    return SELF_CHECK_RESULT("structural_index_check");
+}
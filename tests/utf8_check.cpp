@@ -0,0 +1,166 @@
+/**
+  * Self-check of the UTF-8 validators against a reference that decodes the code points and checks
+  * them against the definition: the overlong forms, the surrogates, the code points above U+10FFFF
+  * and the truncated sequences, put at every offset around the 16 and 32 byte vector boundaries.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "json_utf8.h"
+#include "self_check.h"
+
+using std::string;
+using std::vector;
+
+// Decode each sequence and check the code point it gives, with no lookup of the lead byte ranges
+static bool utf8_reference(const string& s)
+{
+    for (size_t i = 0; i < s.size(); )
+    {
+        unsigned char c = (unsigned char)s[i];
+        size_t n = c < 0x80 ? 1 : (c & 0xe0) == 0xc0 ? 2 : (c & 0xf0) == 0xe0 ? 3 : (c & 0xf8) == 0xf0 ? 4 : 0;
+        if (0 == n || i + n > s.size())
+            return false;
+
+        uint32_t cp = 1 == n ? c : c & (0xff >> (n + 1));
+        for (size_t k = 1; k < n; ++k)
+        {
+            unsigned char cc = (unsigned char)s[i + k];
+            if ((cc & 0xc0) != 0x80)
+                return false;
+            cp = (cp << 6) | (cc & 0x3f);
+        }
+
+        static const uint32_t min_cp[] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (cp < min_cp[n] || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+            return false;
+        i += n;
+    }
+    return true;
+}
+
+struct validator
+{
+    const char*         name;
+    utf8_validate_fn    fn;
+};
+
+static vector<validator> validators;
+static long checked = 0;
+
+static void check_text(const string& s)
+{
+    bool expected = utf8_reference(s);
+    ++checked;
+    for (const validator& v : validators)
+    {
+        bool got = v.fn(s.data(), s.size());
+        CHECK(got == expected);
+        if (got != expected)
+        {
+            printf("  %s: %s for", v.name, got ? "accepted" : "rejected");
+            for (unsigned char c : s)
+                printf(" %02x", c);
+            printf("\n");
+        }
+    }
+    CHECK(utf8_validate(s) == expected);
+}
+
+// The sequence after 'offset' ASCII bytes, alone and followed by more ASCII, to cross the vector boundaries
+static void check_at_offsets(const string& seq)
+{
+    for (size_t offset = 0; offset < 70; offset += (offset < 34 ? 1 : 5))
+    {
+        string pad(offset, 'a');
+        check_text(pad + seq);
+        check_text(pad + seq + "bc");
+        check_text(pad + seq + string(40, 'z'));
+    }
+}
+
+static void check_sequences()
+{
+    // The boundaries of the second byte ranges, as well as the invalid and the ASCII bytes
+    const unsigned char edges[] = { 0x00, 0x41, 0x7f, 0x80, 0x8f, 0x90, 0x9f, 0xa0, 0xbf, 0xc0, 0xc1, 0xc2, 0xdf,
+                                    0xe0, 0xed, 0xef, 0xf0, 0xf4, 0xf5, 0xf8, 0xfe, 0xff };
+
+    // Every pair of bytes
+    for (int a = 0; a < 256; ++a)
+        for (int b = 0; b < 256; ++b)
+            check_text(string(1, (char)a) + (char)b);
+
+    // Every lead byte with the edge bytes after it, as 1 to 4 byte sequences, at the boundaries
+    for (int lead = 0x80; lead < 256; ++lead)
+    {
+        check_at_offsets(string(1, (char)lead));
+        for (unsigned char b : edges)
+        {
+            check_at_offsets(string(1, (char)lead) + (char)b);
+            for (unsigned char c : { (unsigned char)0x80, (unsigned char)0xbf, (unsigned char)0x41, (unsigned char)0xc2 })
+            {
+                check_at_offsets(string(1, (char)lead) + (char)b + (char)c);
+                check_at_offsets(string(1, (char)lead) + (char)b + (char)c + (char)0x80);
+                check_at_offsets(string(1, (char)lead) + (char)b + (char)c + (char)0x41);
+            }
+        }
+    }
+
+    // The named cases
+    check_at_offsets("\xc0\xaf");               // Overlong '/'
+    check_at_offsets("\xe0\x80\xaf");           // Overlong '/' in 3 bytes
+    check_at_offsets("\xf0\x80\x80\xaf");       // Overlong '/' in 4 bytes
+    check_at_offsets("\xe0\x9f\xbf");           // Overlong U+07FF
+    check_at_offsets("\xe0\xa0\x80");           // U+0800
+    check_at_offsets("\xed\x9f\xbf");           // U+D7FF
+    check_at_offsets("\xed\xa0\x80");           // U+D800, a surrogate
+    check_at_offsets("\xed\xbf\xbf");           // U+DFFF, a surrogate
+    check_at_offsets("\xee\x80\x80");           // U+E000
+    check_at_offsets("\xf0\x8f\xbf\xbf");       // Overlong U+FFFF
+    check_at_offsets("\xf0\x90\x80\x80");       // U+10000
+    check_at_offsets("\xf4\x8f\xbf\xbf");       // U+10FFFF
+    check_at_offsets("\xf4\x90\x80\x80");       // U+110000
+    check_at_offsets("\xf0\x9f\x98");           // Truncated U+1F600
+    check_at_offsets("\xf0\x9f\x98\x80\x80");   // U+1F600 and a stray continuation
+    check_at_offsets("\xe2\x82");               // Truncated U+20AC
+}
+
+static void check_random()
+{
+    // Mostly valid pieces glued at random, with a few broken ones
+    const char* pieces[] = { "a", "{\"k\":", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xed\x9f\xbf", "\xf4\x8f\xbf\xbf",
+                             "\x80", "\xc3", "\xe2\x82", "\xf0\x9f\x98", "\xed\xa0\x80", "\xc1\xbf", "\xf5\x80\x80\x80" };
+    const size_t valid_pieces = 7;
+    uint64_t state = 0x2545f4914f6cdd1dull;
+    auto next = [&state]() { state ^= state << 13; state ^= state >> 7; state ^= state << 17; return state; };
+
+    for (int n = 0; n < 20000; ++n)
+    {
+        string s;
+        size_t count = next() % 60;
+        for (size_t i = 0; i < count; ++i)
+            s += pieces[next() % 100 < 97 ? next() % valid_pieces : next() % (sizeof(pieces) / sizeof(pieces[0]))];
+        check_text(s);
+    }
+}
+
+int main()
+{
+    validators.push_back({ "scalar", utf8_validate_scalar });
+    validators.push_back({ "records_scalar", utf8_validate_records_scalar });
+#if defined(JSON_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        validators.push_back({ "ssse3", utf8_validate_records_ssse3 });
+    if (__builtin_cpu_supports("avx2"))
+        validators.push_back({ "avx2", utf8_validate_records_avx2 });
+#endif
+
+    check_text("");
+    check_sequences();
+    check_random();
+    printf("validators checked: %zu, texts: %ld\n", validators.size(), checked);
+    return SELF_CHECK_RESULT("utf8_check");
+}